@@ -0,0 +1,81 @@
+#ifndef _CYCLE_CLOCK_H
+#define _CYCLE_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Cheap timestamps for timing single operations: the time stamp counter
+ * (rdtscp) on x86, the virtual counter on arm64, and the monotonic clock
+ * everywhere else, including wasm where clock_gettime is a single host call.
+ * Convert tick deltas with cycle_clock_ns() after cycle_clock_calibrate().
+ *
+ * The counters are used when CYCLE_CLOCK_COUNTER is defined, which the native
+ * libbpf build does by default.
+ */
+static double cycle_clock_ns_per_tick = 1.0;
+
+static inline uint64_t cycle_clock_monotonic(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(NATIVE_LIBBPF) && !defined(CYCLE_CLOCK_COUNTER)
+#define CYCLE_CLOCK_COUNTER
+#endif
+
+#if defined(CYCLE_CLOCK_COUNTER) && defined(__x86_64__)
+#include <x86intrin.h>
+#define CYCLE_CLOCK_NAME "rdtscp"
+static inline uint64_t cycle_clock_now(void) {
+  unsigned int aux;
+  return __rdtscp(&aux);
+}
+#elif defined(CYCLE_CLOCK_COUNTER) && defined(__aarch64__)
+#define CYCLE_CLOCK_NAME "cntvct"
+static inline uint64_t cycle_clock_now(void) {
+  uint64_t v;
+  asm volatile("isb; mrs %0, cntvct_el0" : "=r"(v)::"memory");
+  return v;
+}
+#else
+#define CYCLE_CLOCK_NAME "clock_gettime"
+#define CYCLE_CLOCK_IS_NS
+static inline uint64_t cycle_clock_now(void) { return cycle_clock_monotonic(); }
+#endif
+
+/* measure the tick rate against CLOCK_MONOTONIC over about 50ms */
+static void cycle_clock_calibrate(void) {
+#ifndef CYCLE_CLOCK_IS_NS
+  struct timespec wait = {0, 50 * 1000 * 1000};
+  uint64_t ns0 = cycle_clock_monotonic(), t0 = cycle_clock_now();
+  uint64_t ns1, t1;
+
+  nanosleep(&wait, NULL);
+  ns1 = cycle_clock_monotonic();
+  t1 = cycle_clock_now();
+  if (t1 > t0)
+    cycle_clock_ns_per_tick = (double)(ns1 - ns0) / (t1 - t0);
+#endif
+}
+
+static inline uint64_t cycle_clock_ns(uint64_t ticks) {
+  return (uint64_t)(ticks * cycle_clock_ns_per_tick + 0.5);
+}
+
+/* cost in ticks of the two clock reads around a timed operation */
+static inline uint64_t cycle_clock_overhead(void) {
+  uint64_t best = UINT64_MAX;
+
+  for (int i = 0; i < 1000; i++) {
+    uint64_t t0 = cycle_clock_now();
+    uint64_t t1 = cycle_clock_now();
+
+    if (t1 - t0 < best)
+      best = t1 - t0;
+  }
+  return best;
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef _LATENCY_HIST_H
+#define _LATENCY_HIST_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Log-linear latency histogram: values below 2^HIST_SUB_BITS get a slot each,
+ * every power of two above that is split into 2^HIST_SUB_BITS equal slots, so
+ * the relative error of a recorded value stays below 2^-HIST_SUB_BITS (~3%).
+ * Values of 2^HIST_MAX_EXP and more all land in the last slot.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 48
+#define HIST_SLOTS ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct latency_hist {
+  uint64_t slots[HIST_SLOTS];
+  uint64_t count;
+  uint64_t max;
+};
+
+static inline void hist_reset(struct latency_hist *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+static inline int hist_slot(uint64_t v) {
+  int exp, shift, slot;
+
+  if (v < HIST_SUB_COUNT)
+    return (int)v;
+  exp = 63 - __builtin_clzll(v);
+  shift = exp - HIST_SUB_BITS;
+  slot = (shift + 1) * HIST_SUB_COUNT + (int)((v >> shift) & (HIST_SUB_COUNT - 1));
+  return slot < HIST_SLOTS ? slot : HIST_SLOTS - 1;
+}
+
+/* largest value that maps to the slot */
+static inline uint64_t hist_slot_high(int slot) {
+  int shift;
+
+  if (slot < HIST_SUB_COUNT)
+    return slot;
+  shift = slot / HIST_SUB_COUNT - 1;
+  return (((uint64_t)HIST_SUB_COUNT + slot % HIST_SUB_COUNT) << shift) +
+         ((uint64_t)1 << shift) - 1;
+}
+
+static inline void hist_record(struct latency_hist *h, uint64_t v) {
+  h->slots[hist_slot(v)]++;
+  h->count++;
+  if (v > h->max)
+    h->max = v;
+}
+
+static inline void hist_merge(struct latency_hist *dst,
+                              const struct latency_hist *src) {
+  for (int i = 0; i < HIST_SLOTS; i++)
+    dst->slots[i] += src->slots[i];
+  dst->count += src->count;
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+/* value at or below which pct percent of the recorded values fall */
+static inline uint64_t hist_percentile(const struct latency_hist *h,
+                                       double pct) {
+  uint64_t target, seen = 0;
+  uint64_t high;
+
+  if (!h->count)
+    return 0;
+  target = (uint64_t)(pct / 100.0 * h->count + 0.5);
+  if (target < 1)
+    target = 1;
+  for (int i = 0; i < HIST_SLOTS; i++) {
+    seen += h->slots[i];
+    if (seen >= target) {
+      high = hist_slot_high(i);
+      return high < h->max ? high : h->max;
+    }
+  }
+  return h->max;
+}
+
+#ifdef _CYCLE_CLOCK_H
+/*
+ * Print the percentiles of a histogram of cycle_clock ticks in nanoseconds,
+ * after the cost of the clock reads that every sample includes. Parsed by
+ * run.py; available when cycle_clock.h is included first.
+ */
+static inline void hist_print_latency(const struct latency_hist *h) {
+  printf("latency clock %s overhead %" PRIu64 "\n", CYCLE_CLOCK_NAME,
+         cycle_clock_ns(cycle_clock_overhead()));
+  printf("latency ns p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64
+         " p999 %" PRIu64 " p9999 %" PRIu64 " max %" PRIu64 "\n",
+         cycle_clock_ns(hist_percentile(h, 50)),
+         cycle_clock_ns(hist_percentile(h, 90)),
+         cycle_clock_ns(hist_percentile(h, 99)),
+         cycle_clock_ns(hist_percentile(h, 99.9)),
+         cycle_clock_ns(hist_percentile(h, 99.99)), cycle_clock_ns(h->max));
+}
+#endif
+
+#endif
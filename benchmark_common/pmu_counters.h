@@ -0,0 +1,156 @@
+#ifndef _PMU_COUNTERS_H
+#define _PMU_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Count instructions, cycles, cache and branch misses and a few software
+ * events of this process (and the threads it starts afterwards) around the
+ * measured loop with perf_event_open. Hardware events that can not be opened,
+ * e.g. in a VM without a virtual PMU, are reported as missing and the software
+ * events are still counted.
+ *
+ * The wasm guest can not call perf_event_open, so the wasm build gets stubs
+ * and run.py counts the whole runtime with perf stat instead.
+ */
+enum {
+  PMU_INSTRUCTIONS,
+  PMU_CYCLES,
+  PMU_CACHE_MISSES,
+  PMU_BRANCH_MISSES,
+  PMU_CONTEXT_SWITCHES,
+  PMU_PAGE_FAULTS,
+  PMU_TASK_CLOCK,
+  PMU_COUNT,
+};
+
+struct pmu_counters {
+  int fds[PMU_COUNT];
+  uint64_t values[PMU_COUNT];
+  bool user_only;
+};
+
+#ifdef NATIVE_LIBBPF
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} pmu_events[PMU_COUNT] = {
+    [PMU_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE,
+                          PERF_COUNT_HW_INSTRUCTIONS},
+    [PMU_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PMU_CACHE_MISSES] = {"cache-misses", PERF_TYPE_HARDWARE,
+                          PERF_COUNT_HW_CACHE_MISSES},
+    [PMU_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE,
+                           PERF_COUNT_HW_BRANCH_MISSES},
+    [PMU_CONTEXT_SWITCHES] = {"context-switches", PERF_TYPE_SOFTWARE,
+                              PERF_COUNT_SW_CONTEXT_SWITCHES},
+    [PMU_PAGE_FAULTS] = {"page-faults", PERF_TYPE_SOFTWARE,
+                         PERF_COUNT_SW_PAGE_FAULTS},
+    [PMU_TASK_CLOCK] = {"task-clock", PERF_TYPE_SOFTWARE,
+                        PERF_COUNT_SW_TASK_CLOCK},
+};
+
+static int pmu_open_event(int i, bool user_only) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = pmu_events[i].type;
+  attr.config = pmu_events[i].config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_hv = 1;
+  attr.exclude_kernel = user_only;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* the measured loops are mostly syscalls, so count the kernel too unless
+ * perf_event_paranoid forbids it */
+static void pmu_open(struct pmu_counters *c) {
+  memset(c, 0, sizeof(*c));
+  for (int i = 0; i < PMU_COUNT; i++) {
+    c->fds[i] = pmu_open_event(i, c->user_only);
+    if (c->fds[i] < 0 && errno == EACCES && !c->user_only) {
+      c->user_only = true;
+      for (int j = 0; j < i; j++)
+        if (c->fds[j] >= 0)
+          close(c->fds[j]);
+      i = -1;
+    }
+  }
+}
+
+static void pmu_start(struct pmu_counters *c) {
+  for (int i = 0; i < PMU_COUNT; i++)
+    if (c->fds[i] >= 0)
+      ioctl(c->fds[i], PERF_EVENT_IOC_RESET, 0);
+  for (int i = 0; i < PMU_COUNT; i++)
+    if (c->fds[i] >= 0)
+      ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/* stop counting and read the values, scaled up if the counter was
+ * multiplexed */
+static void pmu_stop(struct pmu_counters *c) {
+  for (int i = 0; i < PMU_COUNT; i++)
+    if (c->fds[i] >= 0)
+      ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+  for (int i = 0; i < PMU_COUNT; i++) {
+    uint64_t buf[3];
+
+    if (c->fds[i] < 0 || read(c->fds[i], buf, sizeof(buf)) != sizeof(buf))
+      continue;
+    c->values[i] = buf[2] && buf[2] < buf[1]
+                       ? (uint64_t)((double)buf[0] * buf[1] / buf[2])
+                       : buf[0];
+  }
+}
+
+static void pmu_close(struct pmu_counters *c) {
+  for (int i = 0; i < PMU_COUNT; i++)
+    if (c->fds[i] >= 0)
+      close(c->fds[i]);
+}
+
+/* one "pmu <event> <total> <per op>" line per counter, "pmu <event> missing"
+ * if it could not be opened; parsed by run.py */
+static void pmu_print(const struct pmu_counters *c, uint64_t ops) {
+  if (!ops)
+    ops = 1;
+  for (int i = 0; i < PMU_COUNT; i++) {
+    if (c->fds[i] < 0) {
+      printf("pmu %s missing\n", pmu_events[i].name);
+      continue;
+    }
+    printf("pmu %s %llu %.3f\n", pmu_events[i].name,
+           (unsigned long long)c->values[i], (double)c->values[i] / ops);
+  }
+  if (c->user_only)
+    fprintf(stderr, "perf_event_paranoid only allows counting user space\n");
+}
+#else
+static void pmu_open(struct pmu_counters *c) {
+  for (int i = 0; i < PMU_COUNT; i++)
+    c->fds[i] = -1;
+}
+static void pmu_start(struct pmu_counters *c) {}
+static void pmu_stop(struct pmu_counters *c) {}
+static void pmu_close(struct pmu_counters *c) {}
+static void pmu_print(const struct pmu_counters *c, uint64_t ops) {
+  printf("pmu unavailable in wasm, use perf stat on the runtime\n");
+}
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+static struct env {
+  int threads;
+  int duration;
+} env = {
+    .threads = 1,
+    .duration = 10,
+};
+
+const char argp_program_doc[] =
+    "connect() storm for the event buffer benchmark: connects to a listener on\n"
+    "127.0.0.1 and resets the connection in a loop, as fast as it can.\n"
+    "\n"
+    "USAGE: connect_storm [-t THREADS] [-d SEC]\n"
+    "\n"
+    "  -t  threads connecting, 1 by default\n"
+    "  -d  stop after SEC seconds, 10 by default\n"
+    "\n"
+    "On exit it prints the achieved rate:\n"
+    "  storm threads <n> connects <n> elapsed_ns <n> rate <connects per sec>\n";
+
+static atomic_bool stop;
+static struct sockaddr_in addr;
+
+static uint64_t get_monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *acceptor(void *arg) {
+  int listen_fd = *(int *)arg;
+
+  while (true) {
+    int fd = accept(listen_fd, NULL, NULL);
+
+    if (fd >= 0)
+      close(fd);
+  }
+  return NULL;
+}
+
+static void *storm(void *arg) {
+  /* reset instead of closing, the ports would run out in TIME_WAIT */
+  struct linger linger = {.l_onoff = 1, .l_linger = 0};
+  uint64_t connects = 0;
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0)
+      break;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+      connects++;
+    close(fd);
+  }
+  /* count locally, the threads would share the cache line of connects[] */
+  *(uint64_t *)arg = connects;
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  pthread_t threads[MAX_THREADS], accept_thread;
+  uint64_t connects[MAX_THREADS] = {};
+  uint64_t start, elapsed, total = 0;
+  socklen_t addr_len = sizeof(addr);
+  int listen_fd;
+
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      printf("%s", argp_program_doc);
+      return 0;
+    }
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 1;
+    }
+    i++;
+    if (strcmp(arg, "-t") == 0) {
+      env.threads = atoi(val);
+    } else if (strcmp(arg, "-d") == 0) {
+      env.duration = atoi(val);
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 1;
+    }
+  }
+  if (env.threads < 1 || env.threads > MAX_THREADS) {
+    fprintf(stderr, "between 1 and %d threads\n", MAX_THREADS);
+    return 1;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(listen_fd, 4096) ||
+      getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len)) {
+    perror("listen");
+    return 1;
+  }
+  pthread_create(&accept_thread, NULL, acceptor, &listen_fd);
+
+  start = get_monotonic();
+  for (int i = 0; i < env.threads; i++)
+    pthread_create(&threads[i], NULL, storm, &connects[i]);
+  sleep(env.duration);
+  atomic_store(&stop, true);
+  for (int i = 0; i < env.threads; i++) {
+    pthread_join(threads[i], NULL);
+    total += connects[i];
+  }
+  elapsed = get_monotonic() - start;
+  printf("storm threads %d connects %lu elapsed_ns %lu rate %f\n", env.threads,
+         (unsigned long)total, (unsigned long)elapsed,
+         total * 1e9 / elapsed);
+  return 0;
+}
@@ -0,0 +1,196 @@
+import json
+import pathlib
+import os
+import signal
+import subprocess
+import threading
+import time
+import sys
+from typing import Dict, List, Union
+WORK_DIR = pathlib.Path(__file__).parent
+PROJECT_ROOT = WORK_DIR.parent
+sys.path.insert(0, str(PROJECT_ROOT))
+from harness import generate_statistics, repeat, pin_runtime, pin_producer, environment, record_history  # noqa: E402
+ASSETS_DIR = WORK_DIR/"assets"
+WASM_BPF = PROJECT_ROOT/"assets"/"wasm-bpf"
+BPFTOOL = os.environ.get("BPFTOOL", "bpftool")
+RUN_COUNT = 5
+# seconds to wait after starting the tool, so it has loaded and attached
+SETTLE_SECONDS = 3
+STORM_SECONDS = 10
+DRAIN_SECONDS = 1
+STORM_THREADS = max(1, (os.cpu_count() or 1) // 2)
+RUNTIMES = ["native", "wasm"]
+# make arguments of each transport, see examples/common/compat.bpf.h
+TRANSPORTS = {"ringbuf": "", "perfbuf": "PERFBUF=1"}
+# the storm that loads each tool, and the comm its events carry
+STORMS = {
+    "opensnoop": ("open_storm", PROJECT_ROOT/"opensnoop_benchmark"/"open_storm.c"),
+    "tcpconnlat": ("connect_storm", WORK_DIR/"connect_storm.c"),
+}
+TOOLS = list(STORMS)
+CLOCK_TICKS = os.sysconf("SC_CLK_TCK")
+
+
+def build_assets():
+    if not os.path.exists(ASSETS_DIR):
+        os.makedirs(ASSETS_DIR)
+        examples = PROJECT_ROOT/"examples"
+        for transport, make_args in TRANSPORTS.items():
+            root = examples/"opensnoop"
+            os.system(f"cd {root} && make clean && make -j {make_args}")
+            os.system(f"cp {root/'opensnoop.wasm'} {ASSETS_DIR/f'opensnoop-{transport}.wasm'}")
+            os.system(f"cd {root} && make clean")
+            os.system(f"cd {root} && make -f Makefile.native clean && make -f Makefile.native -j {make_args}")
+            os.system(f"cp {root/'opensnoop'} {ASSETS_DIR/f'opensnoop-{transport}'}")
+            root = examples/"tcpconnlat-libbpf-rs"
+            os.system(f"cd {root} && make clean && make {make_args}")
+            os.system(f"cp {root/'tcpconnlat-libbpf-rs.wasm'} {ASSETS_DIR/f'tcpconnlat-{transport}.wasm'}")
+            root = examples/"tcpconnlat-libbpf-rs-native"
+            os.system(f"cd {root} && make clean && make {make_args}")
+            os.system(f"cp {root/'tcpconnlat-libbpf-rs'} {ASSETS_DIR/f'tcpconnlat-{transport}'}")
+        for storm, source in STORMS.values():
+            os.system(f"cc -O2 -pthread {source} -o {ASSETS_DIR/storm}")
+
+
+def cpu_seconds(pid: int) -> float:
+    """user and system time of the process so far"""
+    with open(f"/proc/{pid}/stat") as f:
+        fields = f.read().rpartition(")")[2].split()
+    # utime and stime are fields 14 and 15, the list starts at field 3
+    return (int(fields[11]) + int(fields[12])) / CLOCK_TICKS
+
+
+def rss_kb(pid: int) -> int:
+    """resident memory of the process, the mmapped buffer pages count once
+    they were touched"""
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def process_maps(pid: int) -> List[dict]:
+    """bpftool map show of the bpf maps the process holds open, found by
+    their fdinfo"""
+    maps = []
+    for fd in os.listdir(f"/proc/{pid}/fdinfo"):
+        try:
+            with open(f"/proc/{pid}/fdinfo/{fd}") as f:
+                info = dict(line.split(":", 1) for line in f if ":" in line)
+        except OSError:
+            continue
+        if "map_id" in info:
+            maps.append(json.loads(subprocess.check_output(
+                [BPFTOOL, "map", "show", "id", info["map_id"].strip(), "--json"])))
+    return maps
+
+
+def map_memlock(pid: int) -> int:
+    """bytes_memlock of the bpf maps the process holds open"""
+    return sum(int(m.get("bytes_memlock", 0)) for m in process_maps(pid))
+
+
+def read_drops(pid: int) -> int:
+    """events the tool's bpf program could not put in a full buffer, from
+    the drops map of compat.bpf.h"""
+    for m in process_maps(pid):
+        if m.get("name") != "drops":
+            continue
+        entry = json.loads(subprocess.check_output(
+            [BPFTOOL, "map", "lookup", "id", str(m["id"]), "key", "0", "0", "0", "0", "--json"]))
+        if "formatted" in entry:
+            return int(entry["formatted"]["value"])
+        return int.from_bytes(bytes(int(b, 16) for b in entry["value"]), sys.byteorder)
+    raise ValueError(f"no drops map in process {pid}")
+
+
+def run_storm(storm: str) -> float:
+    """operations per second of the storm"""
+    out = subprocess.check_output(pin_producer(
+        [str(ASSETS_DIR/storm), "-t", str(STORM_THREADS), "-d", str(STORM_SECONDS)]), text=True)
+    for line in out.splitlines():
+        if line.startswith("storm threads"):
+            return float(line.split()[-1])
+    raise ValueError(f"no rate in the {storm} output")
+
+
+def run_once(tool: str, runtime: Union[str, None], transport: str) -> Dict[str, float]:
+    """Rate of the storm, and how many of its events per second the tool
+    printed, its CPU use and memory meanwhile, or only the rate without the
+    tool if runtime is None"""
+    storm, _ = STORMS[tool]
+    if runtime is None:
+        return {"storm_per_sec": run_storm(storm)}
+    binary = ASSETS_DIR/f"{tool}-{transport}"
+    # opensnoop matches the storm in the kernel, tcpconnlat sees every connect
+    args = ["-n", storm] if tool == "opensnoop" else []
+    if runtime == "native":
+        cmd = [str(binary), *args]
+    else:
+        cmd = [str(WASM_BPF), f"{binary}.wasm", *args]
+    cmd = pin_runtime(cmd)
+    print(cmd)
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, cwd=ASSETS_DIR)
+    events = [0]
+
+    def count_events():
+        for line in proc.stdout:
+            if storm.encode() in line:
+                events[0] += 1
+    reader = threading.Thread(target=count_events)
+    reader.start()
+    try:
+        time.sleep(SETTLE_SECONDS)
+        cpu_before = cpu_seconds(proc.pid)
+        drops_before = read_drops(proc.pid)
+        events_before = events[0]
+        start = time.monotonic()
+        storm_per_sec = run_storm(storm)
+        elapsed = time.monotonic() - start
+        cpu = cpu_seconds(proc.pid) - cpu_before
+        # let the tool print what is still in the buffers
+        time.sleep(DRAIN_SECONDS)
+        result = {
+            "storm_per_sec": storm_per_sec,
+            "events_per_sec": (events[0] - events_before) / elapsed,
+            "drops": read_drops(proc.pid) - drops_before,
+            "consumer_cpu": cpu / elapsed,
+            "rss_kb": rss_kb(proc.pid),
+            "map_memlock": map_memlock(proc.pid),
+        }
+    finally:
+        proc.send_signal(signal.SIGTERM)
+        proc.wait()
+        reader.join()
+    print(tool, runtime, transport, result)
+    return result
+
+
+def main():
+    """opensnoop and tcpconnlat with their events in a ring buffer and in
+    perf buffers, under an open() and a connect() storm"""
+    build_assets()
+    result = {"environment": environment()}
+    better = {"storm_per_sec": "higher", "events_per_sec": "higher", "drops": "lower", "consumer_cpu": "lower",
+              "rss_kb": "lower", "map_memlock": "lower"}
+    for tool in TOOLS:
+        baseline = repeat(lambda _: run_once(tool, None, ""), RUN_COUNT)
+        result[tool] = {"no_probe": {
+            "storm_per_sec": generate_statistics([r["storm_per_sec"] for r in baseline], "higher")}}
+        for runtime in RUNTIMES:
+            result[tool][runtime] = {}
+            for transport in TRANSPORTS:
+                runs = repeat(lambda _: run_once(tool, runtime, transport), RUN_COUNT)
+                result[tool][runtime][transport] = {
+                    key: generate_statistics([run[key] for run in runs], better[key]) for key in runs[0]
+                }
+    print(result)
+    with open(WORK_DIR/"result.json", "w") as f:
+        json.dump(result, f)
+    record_history("event_buffer_benchmark", "result.json", result)
+
+
+if __name__ == "__main__":
+    main()
@@ -22,11 +22,16 @@ struct {
 
 const volatile unsigned long long min_duration_ns = 0;
 
+/* unused, the events are built on the stack and in the ring buffer: only
+ * puts struct event in the BTF, where harness/binlog.py reads its layout from */
+struct event *_event __attribute__((unused));
+
 SEC("tp/sched/sched_process_exec")
 int handle_exec(struct trace_event_raw_sched_process_exec* ctx) {
     struct task_struct* task;
     unsigned fname_off;
-    struct event* e;
+    struct event e;
+    long len;
     pid_t pid;
     u64 ts;
 
@@ -39,25 +44,28 @@ int handle_exec(struct trace_event_raw_sched_process_exec* ctx) {
     if (min_duration_ns)
         return 0;
 
-    /* reserve sample from BPF ringbuf */
-    e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-    if (!e)
-        return 0;
+    /* the size is only known once the filename is read, so the sample is
+     * built on the stack and copied out with only the bytes it uses */
+    __builtin_memset(&e, 0, sizeof(e));
 
     /* fill out the sample with data */
     task = (struct task_struct*)bpf_get_current_task();
 
-    e->exit_event = false;
-    e->pid = pid;
-    e->ppid = BPF_CORE_READ(task, real_parent, tgid);
-    bpf_get_current_comm(&e->comm, sizeof(e->comm));
+    e.exit_event = false;
+    e.pid = pid;
+    e.ppid = BPF_CORE_READ(task, real_parent, tgid);
+    bpf_get_current_comm(&e.comm, sizeof(e.comm));
 
     fname_off = ctx->__data_loc_filename & 0xFFFF;
-    bpf_probe_read_str(&e->filename, sizeof(e->filename),
-                       (void*)ctx + fname_off);
+    len = bpf_probe_read_str(&e.filename, sizeof(e.filename),
+                             (void*)ctx + fname_off);
+    if (len <= 0)
+        len = 1;
+    if (len > MAX_FILENAME_LEN)
+        len = MAX_FILENAME_LEN;
 
     /* successfully submit it to user-space for post-processing */
-    bpf_ringbuf_submit(e, 0);
+    bpf_ringbuf_output(&rb, &e, offsetof(struct event, filename) + len, 0);
     return 0;
 }
 
@@ -89,8 +97,8 @@ int handle_exit(struct trace_event_raw_sched_process_template* ctx) {
     if (min_duration_ns && duration_ns < min_duration_ns)
         return 0;
 
-    /* reserve sample from BPF ringbuf */
-    e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+    /* reserve sample from BPF ringbuf, exit events carry no filename */
+    e = bpf_ringbuf_reserve(&rb, offsetof(struct event, filename), 0);
     if (!e)
         return 0;
 
@@ -1,14 +1,25 @@
 // SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
 /* Copyright (c) 2020 Facebook */
 #include <stdbool.h>
+#include "startup_phases.h"
 #include "bootstrap.skel.h"
 #include "bootstrap.wasm.h"
+#include "bootstrap.schema.h"
+#include "output.h"
 #include <stdio.h>
 #include <time.h>
 
+/* Output buffer, flushed when full and after every poll */
+#define SINK_SIZE (64 * 1024)
+
+/* Binary log buffer, written out and synced to disk this often */
+#define BINLOG_SIZE (1024 * 1024)
+#define BINLOG_SYNC_MS 1000
+
 static struct env {
   bool verbose;
   long min_duration_ms;
+  const char *binary_out;
 } env;
 
 const char *argp_program_version = "bootstrap 0.0";
@@ -19,7 +30,10 @@ const char argp_program_doc[] =
     "It traces process start and exits and shows associated \n"
     "information (filename, process duration, PID and PPID, etc).\n"
     "\n"
-    "USAGE: ./bootstrap [-d <min-duration-ms>] -v\n";
+    "USAGE: ./bootstrap [-d <min-duration-ms>] [--binary-out FILE] -v\n"
+    "\n"
+    "--binary-out appends the raw events to FILE instead of printing them,\n"
+    "decode it with python3 -m harness.binlog decode FILE\n";
 
 static void print_usage(void) {
   printf("%s\n", argp_program_version);
@@ -28,25 +42,39 @@ static void print_usage(void) {
 
 static int handle_event(void *ctx, void *data, size_t data_sz) {
   const struct event *e = data;
-  struct tm *tm;
-  char ts[32];
-  time_t t;
 
-  time(&t);
-  tm = localtime(&t);
-  strftime(ts, sizeof(ts), "%H:%M:%S", tm);
+  /* records end where the bpf side stopped: exit events before filename,
+   * exec events after the NUL of filename */
+  if (data_sz < offsetof(struct event, filename))
+    return 0;
+  if (env.binary_out) {
+    binlog_write(data, data_sz);
+    return 0;
+  }
 
+  sink_str(sink_time(), -8);
+  sink_char(' ');
+  sink_str(e->exit_event ? "EXIT" : "EXEC", -5);
+  sink_char(' ');
+  sink_strn(e->comm, sizeof(e->comm), -16);
+  sink_char(' ');
+  sink_int(e->pid, -7);
+  sink_char(' ');
+  sink_int(e->ppid, -7);
+  sink_char(' ');
   if (e->exit_event) {
-    printf("%-8s %-5s %-16s %-7d %-7d [%u]", ts, "EXIT", e->comm, e->pid,
-           e->ppid, e->exit_code);
-    if (e->duration_ns)
-      printf(" (%llums)", e->duration_ns / 1000000);
-    printf("\n");
+    sink_char('[');
+    sink_uint(e->exit_code, 0);
+    sink_char(']');
+    if (e->duration_ns) {
+      sink_str(" (", 0);
+      sink_uint(e->duration_ns / 1000000, 0);
+      sink_str("ms)", 0);
+    }
   } else {
-    printf("%-8s %-5s %-16s %-7d %-7d %s\n", ts, "EXEC", e->comm, e->pid,
-           e->ppid, e->filename);
+    sink_strn(e->filename, data_sz - offsetof(struct event, filename), 0);
   }
-
+  sink_char('\n');
   return 0;
 }
 
@@ -62,14 +90,24 @@ int main(int argc, char **argv) {
   struct bootstrap_bpf *skel;
   int err;
 
+  startup_mark("main", NULL);
+
   // parse the args manually for demo purpose
-  if (argc > 3 || (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
-                                 strcmp(argv[1], "--help") == 0))) {
-    print_usage();
-    return 0;
-  } else if (argc == 3 && (strcmp(argv[1], "-d") == 0 ||
-                           strcmp(argv[1], "--duration") == 0)) {
-    env.min_duration_ms = strtol(argv[2], NULL, 10);
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      print_usage();
+      return 0;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      env.verbose = true;
+    } else if (i + 1 < argc && (strcmp(argv[i], "-d") == 0 ||
+                                strcmp(argv[i], "--duration") == 0)) {
+      env.min_duration_ms = strtol(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--binary-out") == 0) {
+      env.binary_out = argv[++i];
+    } else {
+      print_usage();
+      return 1;
+    }
   }
 
   /* Load and verify BPF application */
@@ -78,6 +116,7 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Failed to open and load BPF skeleton\n");
     return 1;
   }
+  startup_mark("open", NULL);
 
   /* Parameterize BPF code with minimum duration parameter */
   skel->rodata->min_duration_ns = env.min_duration_ms * 1000000ULL;
@@ -88,15 +127,24 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Failed to load and verify BPF skeleton\n");
     goto cleanup;
   }
+#ifdef NATIVE_LIBBPF
+  /* the wasm sdk marks the end of wasm_load_bpf_object itself */
+  startup_mark("load", NULL);
+#endif
 
-  /* Attach tracepoints */
+  /* Attach tracepoints, one phase per program */
+#ifdef NATIVE_LIBBPF
+  err = startup_attach_skeleton(skel->skeleton);
+#else
   err = bootstrap_bpf__attach(skel);
+#endif
   if (err) {
     fprintf(stderr, "Failed to attach BPF skeleton\n");
     goto cleanup;
   }
   puts("Attach ok!");
   fflush(stdout);
+  startup_report();
 /* Set up ring buffer polling */
 #ifdef NATIVE_LIBBPF
   rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), handle_event, NULL, NULL);
@@ -108,9 +156,23 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Failed to create ring buffer\n");
     goto cleanup;
   }
+  if (env.binary_out) {
+    err = binlog_open(env.binary_out, event_schema, BINLOG_SIZE,
+                      BINLOG_SYNC_MS);
+    if (err) {
+      fprintf(stderr, "Failed to open %s: %s\n", env.binary_out,
+              err == -EINVAL ? "written with another schema" : strerror(-err));
+      goto cleanup;
+    }
+  }
   /* Process events */
-  printf("%-8s %-5s %-16s %-7s %-7s %s\n", "TIME", "EVENT", "COMM", "PID",
-         "PPID", "FILENAME/EXIT CODE");
+  if (!env.binary_out)
+    printf("%-8s %-5s %-16s %-7s %-7s %s\n", "TIME", "EVENT", "COMM", "PID",
+           "PPID", "FILENAME/EXIT CODE");
+  /* stdout is a pipe under the benchmarks, don't hold events back past
+   * the poll that brought them */
+  if (sink_init(SINK_SIZE, 0))
+    fprintf(stderr, "no output buffer, falling back to stdio\n");
   while (!exiting) {
 // poll buffer
 #ifndef NATIVE_LIBBPF
@@ -127,9 +189,14 @@ int main(int argc, char **argv) {
       printf("Error polling perf buffer: %d\n", err);
       break;
     }
+    sink_tick();
+    binlog_tick();
+    fflush(stdout);
   }
 
 cleanup:
+  sink_flush();
+  binlog_close();
 #ifdef NATIVE_LIBBPF
   ring_buffer__free(rb);
 #else
@@ -6,14 +6,16 @@
 #define TASK_COMM_LEN 16
 #define MAX_FILENAME_LEN 127
 
+/* variable length: filename comes last and only the bytes of it up to and
+ * including the NUL are sent, exit events stop before it */
 struct event {
     int pid;
     int ppid;
     unsigned exit_code;
     unsigned long long duration_ns;
     char comm[TASK_COMM_LEN];
-    char filename[MAX_FILENAME_LEN];
     char exit_event;
+    char filename[MAX_FILENAME_LEN];
 };
 
 #endif /* __BOOTSTRAP_H */
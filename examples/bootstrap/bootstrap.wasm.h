@@ -14,8 +14,8 @@ struct event {
     char __pad0[4];
     unsigned long long duration_ns;
     char comm[16];
-    char filename[127];
     char exit_event;
+    char filename[127];
 } __attribute__((packed));
 static_assert(sizeof(struct event) == 168, "Size of event is not 168");
 
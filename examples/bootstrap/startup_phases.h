@@ -0,0 +1,84 @@
+#ifndef _STARTUP_PHASES_H
+#define _STARTUP_PHASES_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Startup phase marks for startup_benchmark. Each mark records the
+ * CLOCK_MONOTONIC time a phase finished; startup_report() prints the time
+ * spent in each phase after the previous mark as a trailer:
+ *
+ *   startup-clock <CLOCK_MONOTONIC ns of the first mark>
+ *   startup-phase <phase>[:<program>] <ns>
+ *   ...
+ *   startup-phases-end
+ *
+ * The first mark should be taken at the top of main, run.py subtracts the
+ * time it spawned the process from startup-clock to get the exec phase.
+ * Include this before the skeleton so the wasm sdk picks up the hook.
+ */
+#define STARTUP_MAX_PHASES 32
+
+struct startup_phase {
+  char name[64];
+  uint64_t ns;
+};
+
+static struct startup_phase startup_phases[STARTUP_MAX_PHASES];
+static int startup_phase_cnt;
+
+static uint64_t startup_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void startup_mark(const char *phase, const char *prog) {
+  struct startup_phase *p;
+
+  if (startup_phase_cnt >= STARTUP_MAX_PHASES)
+    return;
+  p = &startup_phases[startup_phase_cnt++];
+  p->ns = startup_now();
+  if (prog)
+    snprintf(p->name, sizeof(p->name), "%s:%s", phase, prog);
+  else
+    snprintf(p->name, sizeof(p->name), "%s", phase);
+}
+
+#define LIBBPF_WASM_PHASE(phase, prog) startup_mark(phase, prog)
+
+static void startup_report(void) {
+  if (!startup_phase_cnt)
+    return;
+  printf("startup-clock %llu\n", (unsigned long long)startup_phases[0].ns);
+  for (int i = 1; i < startup_phase_cnt; i++)
+    printf("startup-phase %s %llu\n", startup_phases[i].name,
+           (unsigned long long)(startup_phases[i].ns - startup_phases[i - 1].ns));
+  printf("startup-phases-end\n");
+  fflush(stdout);
+}
+
+#ifdef NATIVE_LIBBPF
+#include <bpf/libbpf.h>
+
+/* bpf_object__attach_skeleton() with a mark after every program */
+static int startup_attach_skeleton(struct bpf_object_skeleton *s) {
+  for (int i = 0; i < s->prog_cnt; i++) {
+    struct bpf_prog_skeleton *prog_skel = (void *)s->progs + i * s->prog_skel_sz;
+    struct bpf_link *link = bpf_program__attach(*prog_skel->prog);
+    int err = libbpf_get_error(link);
+
+    if (err)
+      return err;
+    *prog_skel->link = link;
+    startup_mark("attach", bpf_program__name(*prog_skel->prog));
+  }
+  return 0;
+}
+#endif
+
+#endif
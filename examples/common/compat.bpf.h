@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __COMPAT_BPF_H
+#define __COMPAT_BPF_H
+
+#include <vmlinux.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+
+/*
+ * events is a ring buffer, events are reserved in it and submitted in place.
+ * Kernels before 5.8 have none, there userspace turns events into a perf
+ * event array before load and the events are built in heap and copied out
+ * with bpf_perf_event_output. Build with -DEVENTS_PERFBUF to always use the
+ * perf buffer, the wasm runtime can not change the map type at load time.
+ *
+ * Variable-length events, whose size is only known once they are filled in,
+ * are built in heap_buf() and sent with output_buf() instead: it copies only
+ * size bytes, into either kind of buffer.
+ *
+ * Events that do not fit, a failed reserve or output with either kind of
+ * buffer, are counted in drops; a full ring buffer tells userspace nothing
+ * else.
+ */
+#ifndef MAX_EVENT_SIZE
+#define MAX_EVENT_SIZE 10240
+#endif
+
+#ifndef EVENTS_RINGBUF_SIZE
+#define EVENTS_RINGBUF_SIZE (256 * 1024)
+#endif
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __uint(value_size, MAX_EVENT_SIZE);
+} heap SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, u64);
+} drops SEC(".maps");
+
+#ifdef EVENTS_PERFBUF
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+    __uint(key_size, sizeof(u32));
+    __uint(value_size, sizeof(u32));
+} events SEC(".maps");
+#else
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, EVENTS_RINGBUF_SIZE);
+} events SEC(".maps");
+#endif
+
+/* resolved at load time, the verifier drops the other branch */
+static __always_inline bool events_ringbuf(void) {
+#ifdef EVENTS_PERFBUF
+    return false;
+#else
+    return bpf_core_type_exists(struct bpf_ringbuf);
+#endif
+}
+
+static __always_inline void count_drop(void) {
+    static const u32 zero = 0;
+    u64* cnt = bpf_map_lookup_elem(&drops, &zero);
+
+    if (cnt)
+        __sync_fetch_and_add(cnt, 1);
+}
+
+static __always_inline void* reserve_buf(u64 size) {
+    static const u32 zero = 0;
+    void* buf;
+
+    if (events_ringbuf()) {
+        buf = bpf_ringbuf_reserve(&events, size, 0);
+        if (!buf)
+            count_drop();
+        return buf;
+    }
+    return bpf_map_lookup_elem(&heap, &zero);
+}
+
+static __always_inline void submit_buf(void* ctx, void* buf, u64 size) {
+    if (events_ringbuf()) {
+        bpf_ringbuf_submit(buf, 0);
+        return;
+    }
+    if (bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, buf, size))
+        count_drop();
+}
+
+static __always_inline void* heap_buf(void) {
+    static const u32 zero = 0;
+
+    return bpf_map_lookup_elem(&heap, &zero);
+}
+
+static __always_inline void output_buf(void* ctx, void* buf, u64 size) {
+    long err;
+
+    if (events_ringbuf())
+        err = bpf_ringbuf_output(&events, buf, size, 0);
+    else
+        err = bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, buf, size);
+    if (err)
+        count_drop();
+}
+
+#endif /* __COMPAT_BPF_H */
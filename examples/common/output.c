@@ -0,0 +1,306 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+/*
+ * Output of the event handlers, shared by bootstrap, execve and opensnoop:
+ * their Makefiles build it from examples/common.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "output.h"
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct {
+    char* buf;
+    size_t size;
+    size_t len;
+    unsigned long long flush_ns;
+    unsigned long long last_flush;
+    time_t time_sec;
+    char time_str[16];
+} sink;
+
+int sink_init(size_t size, unsigned int flush_ms) {
+    sink.buf = malloc(size);
+    if (!sink.buf)
+        return -ENOMEM;
+    sink.size = size;
+    sink.len = 0;
+    sink.flush_ns = flush_ms * 1000000ULL;
+    sink.last_flush = now_ns();
+    return 0;
+}
+
+static void write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        /* like stdio, output that can not be written is dropped */
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+void sink_flush(void) {
+    /* what went through printf so far goes first */
+    fflush(stdout);
+    if (sink.len)
+        write_all(STDOUT_FILENO, sink.buf, sink.len);
+    sink.len = 0;
+    sink.last_flush = now_ns();
+}
+
+void sink_tick(void) {
+    if (!sink.len)
+        return;
+    if (!sink.flush_ns || now_ns() - sink.last_flush >= sink.flush_ns)
+        sink_flush();
+}
+
+static void sink_append(const char* data, size_t len) {
+    if (!sink.buf) {
+        fwrite(data, 1, len, stdout);
+        return;
+    }
+    if (sink.len + len > sink.size) {
+        sink_flush();
+        if (len > sink.size) {
+            write_all(STDOUT_FILENO, data, len);
+            return;
+        }
+    }
+    memcpy(sink.buf + sink.len, data, len);
+    sink.len += len;
+}
+
+static void sink_pad(size_t len, int width, char pad) {
+    char spaces[64];
+    size_t n;
+
+    if (width < 0)
+        width = -width;
+    if ((size_t)width <= len)
+        return;
+    n = width - len;
+    memset(spaces, pad, min(n, sizeof(spaces)));
+    while (n) {
+        size_t chunk = min(n, sizeof(spaces));
+
+        sink_append(spaces, chunk);
+        n -= chunk;
+    }
+}
+
+static void sink_field(const char* s, size_t len, int width, char pad) {
+    if (width > 0)
+        sink_pad(len, width, pad);
+    sink_append(s, len);
+    if (width < 0)
+        sink_pad(len, width, pad);
+}
+
+void sink_char(char c) {
+    if (sink.buf && sink.len < sink.size) {
+        sink.buf[sink.len++] = c;
+        return;
+    }
+    sink_append(&c, 1);
+}
+
+void sink_strn(const char* s, size_t max, int width) {
+    sink_field(s, strnlen(s, max), width, ' ');
+}
+
+void sink_str(const char* s, int width) {
+    sink_field(s, strlen(s), width, ' ');
+}
+
+/* digits of v in base, written backwards from end */
+static char* sink_digits(char* end, unsigned long long v, unsigned int base) {
+    do {
+        *--end = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    return end;
+}
+
+void sink_uint(unsigned long long v, int width) {
+    char digits[24];
+    char* p = sink_digits(digits + sizeof(digits), v, 10);
+
+    sink_field(p, digits + sizeof(digits) - p, width, ' ');
+}
+
+void sink_int(long long v, int width) {
+    char digits[24];
+    char* p;
+
+    if (v >= 0) {
+        sink_uint(v, width);
+        return;
+    }
+    p = sink_digits(digits + sizeof(digits), -(unsigned long long)v, 10);
+    *--p = '-';
+    sink_field(p, digits + sizeof(digits) - p, width, ' ');
+}
+
+void sink_oct(unsigned long long v, int width) {
+    char digits[24];
+    char* p = sink_digits(digits + sizeof(digits), v, 8);
+
+    sink_field(p, digits + sizeof(digits) - p, width > 0 ? width : -width, '0');
+}
+
+const char* sink_time(void) {
+    time_t t = time(NULL);
+    struct tm* tm;
+
+    if (t != sink.time_sec || !sink.time_str[0]) {
+        tm = localtime(&t);
+        strftime(sink.time_str, sizeof(sink.time_str), "%H:%M:%S", tm);
+        sink.time_sec = t;
+    }
+    return sink.time_str;
+}
+
+static struct {
+    int fd;
+    char* buf;
+    size_t size;
+    size_t len;
+    unsigned long long sync_ns;
+    unsigned long long last_sync;
+    bool unsynced;
+} binlog = { .fd = -1 };
+
+/* the header binlog_open() writes, or finds at the start of the file */
+static int binlog_header(const char* schema, char** header, size_t* len) {
+    unsigned int bom = 0x01020304, schema_len = strlen(schema);
+    char* p;
+
+    *len = BINLOG_MAGIC_LEN + 2 * sizeof(unsigned int) + schema_len;
+    p = *header = malloc(*len);
+    if (!p)
+        return -ENOMEM;
+    memcpy(p, BINLOG_MAGIC, BINLOG_MAGIC_LEN);
+    p += BINLOG_MAGIC_LEN;
+    memcpy(p, &bom, sizeof(bom));
+    p += sizeof(bom);
+    memcpy(p, &schema_len, sizeof(schema_len));
+    p += sizeof(schema_len);
+    memcpy(p, schema, schema_len);
+    return 0;
+}
+
+int binlog_open(const char* path, const char* schema, size_t size,
+                unsigned int sync_ms) {
+    char *header, *found = NULL;
+    size_t len;
+    struct stat st;
+    int err;
+
+    err = binlog_header(schema, &header, &len);
+    if (err)
+        return err;
+    binlog.buf = malloc(size);
+    binlog.fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (!binlog.buf || binlog.fd < 0 || fstat(binlog.fd, &st)) {
+        err = binlog.buf ? -errno : -ENOMEM;
+        goto err_out;
+    }
+    if (st.st_size) {
+        /* appending to an older log: the records have to fit its schema */
+        found = malloc(len);
+        if (!found) {
+            err = -ENOMEM;
+            goto err_out;
+        }
+        if ((size_t)st.st_size < len || pread(binlog.fd, found, len, 0) != (ssize_t)len ||
+            memcmp(found, header, len)) {
+            err = -EINVAL;
+            goto err_out;
+        }
+    } else {
+        write_all(binlog.fd, header, len);
+    }
+    free(found);
+    free(header);
+    binlog.size = size;
+    binlog.len = 0;
+    binlog.sync_ns = sync_ms * 1000000ULL;
+    binlog.last_sync = now_ns();
+    return 0;
+
+err_out:
+    free(found);
+    free(header);
+    free(binlog.buf);
+    binlog.buf = NULL;
+    if (binlog.fd >= 0)
+        close(binlog.fd);
+    binlog.fd = -1;
+    return err;
+}
+
+static void binlog_flush(void) {
+    if (binlog.len)
+        write_all(binlog.fd, binlog.buf, binlog.len);
+    binlog.len = 0;
+}
+
+void binlog_write(const void* data, unsigned int len) {
+    binlog.unsynced = true;
+    if (binlog.len + sizeof(len) + len > binlog.size) {
+        binlog_flush();
+        if (sizeof(len) + len > binlog.size) {
+            write_all(binlog.fd, (const char*)&len, sizeof(len));
+            write_all(binlog.fd, data, len);
+            return;
+        }
+    }
+    memcpy(binlog.buf + binlog.len, &len, sizeof(len));
+    memcpy(binlog.buf + binlog.len + sizeof(len), data, len);
+    binlog.len += sizeof(len) + len;
+}
+
+void binlog_tick(void) {
+    unsigned long long now;
+
+    if (binlog.fd < 0 || !binlog.unsynced)
+        return;
+    now = now_ns();
+    if (now - binlog.last_sync < binlog.sync_ns)
+        return;
+    binlog_flush();
+    fsync(binlog.fd);
+    binlog.last_sync = now;
+    binlog.unsynced = false;
+}
+
+void binlog_close(void) {
+    if (binlog.fd < 0)
+        return;
+    binlog_flush();
+    fsync(binlog.fd);
+    close(binlog.fd);
+    free(binlog.buf);
+    binlog.buf = NULL;
+    binlog.fd = -1;
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <stddef.h>
+
+/*
+ * Buffered output for the event handlers. In wasm every printf() that
+ * reaches stdout is a separate fd_write host call, so the handlers append
+ * their columns to one large buffer instead, which goes out in a single
+ * write() when it fills up or when sink_tick() finds it older than
+ * *flush_ms*; 0 flushes on every sink_tick(), once per poll. Call
+ * sink_tick() from the poll loop and sink_flush() before exiting.
+ *
+ * *width* pads like printf: positive right aligns, negative left aligns.
+ */
+int sink_init(size_t size, unsigned int flush_ms);
+void sink_flush(void);
+void sink_tick(void);
+void sink_char(char c);
+/* at most *max* bytes of *s*, up to its NUL */
+void sink_strn(const char* s, size_t max, int width);
+void sink_str(const char* s, int width);
+void sink_int(long long v, int width);
+void sink_uint(unsigned long long v, int width);
+/* octal, padded with zeros to *width* */
+void sink_oct(unsigned long long v, int width);
+/* HH:MM:SS of the current second, formatted once per second */
+const char* sink_time(void);
+
+/*
+ * Binary event log, for offline analysis without formatting and parsing
+ * text. The file starts with BINLOG_MAGIC, 0x01020304 as a u32 in the byte
+ * order of the writer, the schema length as a u32 and the schema, the
+ * layout of the event struct as JSON generated from its BTF by
+ * harness/binlog.py. Then come the records as the bpf program sent them,
+ * each after its length as a u32. The file is opened O_APPEND; if it
+ * already has a header it must carry the same schema. Records are
+ * buffered in *size* bytes and binlog_tick() writes and fsync()s them
+ * every *sync_ms*. Call binlog_close() before exiting.
+ */
+#define BINLOG_MAGIC "BPFBLOG1"
+#define BINLOG_MAGIC_LEN 8
+
+int binlog_open(const char* path, const char* schema, size_t size,
+                unsigned int sync_ms);
+void binlog_write(const void* data, unsigned int len);
+void binlog_tick(void);
+void binlog_close(void);
+
+#endif /* __OUTPUT_H */
@@ -9,6 +9,10 @@ struct {
     __uint(max_entries, 256 * 1024);
 } comm_event SEC(".maps");
 
+/* unused, the events are built on the stack: only puts struct comm_event in
+ * the BTF, where harness/binlog.py reads its layout from */
+struct comm_event *_comm_event __attribute__((unused));
+
 struct execve_args {
     struct trace_entry common;
     int unused;
@@ -51,7 +55,14 @@ int sys_enter_execve(struct execve_args* ctx) {
     bpf_printk("pid: %d, proc: %s, execve:  %s", comm.pid, comm.parent_proc,
                comm.command);
 
-    bpf_ringbuf_output(&comm_event, &comm, sizeof(struct comm_event), 0);
+    /* send the command line up to its NUL, not all of COMM_SIZE; the lower
+     * bound is for the verifier */
+    if (start >= 0 && start < end)
+        start++;
+    else
+        start = COMM_SIZE;
+    bpf_ringbuf_output(&comm_event, &comm,
+                       offsetof(struct comm_event, command) + start, 0);
 
     return 0;
 }
\ No newline at end of file
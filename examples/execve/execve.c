@@ -1,18 +1,70 @@
+#include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "execve.h"
 #include "execve.skel.h"
+#include "execve.schema.h"
+#include "output.h"
 
 #ifndef NATIVE_LIBBPF
 #include "libbpf-wasm.h"
 #endif
 #include <stdio.h>
+#include <string.h>
+
+/* Output buffer, flushed when full or after this long */
+#define SINK_SIZE (64 * 1024)
+#define SINK_FLUSH_MS 100
+
+/* Binary log buffer, written out and synced to disk this often */
+#define BINLOG_SIZE (1024 * 1024)
+#define BINLOG_SYNC_MS 1000
+
+static const char *binary_out;
+
 static int handle_event(void *ctx, void *data, size_t data_sz) {
   struct comm_event *st = (struct comm_event *)data;
-  printf("[%d] %s -> %s\n", st->pid, st->parent_proc, st->command);
+
+  if (data_sz < offsetof(struct comm_event, command))
+    return 0;
+  if (binary_out) {
+    binlog_write(data, data_sz);
+    return 0;
+  }
+  sink_char('[');
+  sink_int(st->pid, 0);
+  sink_str("] ", 0);
+  sink_strn(st->parent_proc, sizeof(st->parent_proc), 0);
+  sink_str(" -> ", 0);
+  sink_strn(st->command, data_sz - offsetof(struct comm_event, command), 0);
+  sink_char('\n');
   return 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  // parse the args manually for demo purpose
+  if (argc == 3 && strcmp(argv[1], "--binary-out") == 0) {
+    binary_out = argv[2];
+  } else if (argc != 1) {
+    printf("USAGE: execve [--binary-out FILE]\n"
+           "\n"
+           "--binary-out appends the raw events to FILE instead of printing\n"
+           "them, decode it with python3 -m harness.binlog decode FILE\n");
+    return argc == 2 && (strcmp(argv[1], "-h") == 0 ||
+                         strcmp(argv[1], "--help") == 0)
+               ? 0
+               : 1;
+  }
+  if (binary_out) {
+    int err = binlog_open(binary_out, comm_event_schema, BINLOG_SIZE,
+                          BINLOG_SYNC_MS);
+
+    if (err) {
+      fprintf(stderr, "failed to open %s: %s\n", binary_out,
+              err == -EINVAL ? "written with another schema" : strerror(-err));
+      return 1;
+    }
+  }
   struct execve_bpf *skel = execve_bpf__open_and_load();
   execve_bpf__attach(skel);
 #ifdef NATIVE_LIBBPF
@@ -24,6 +76,8 @@ int main() {
       bpf_buffer__open(skel->maps.comm_event, handle_event, NULL);
 
 #endif
+  if (sink_init(SINK_SIZE, SINK_FLUSH_MS))
+    fprintf(stderr, "no output buffer, falling back to stdio\n");
   while (1) {
     if (
 #ifdef NATIVE_LIBBPF
@@ -33,6 +87,10 @@ int main() {
 #endif
         < 0)
       break;
+    sink_tick();
+    binlog_tick();
   }
+  sink_flush();
+  binlog_close();
   return 0;
 }
@@ -3,6 +3,7 @@
 
 #define ARG_LEN COMM_SIZE / MAX_ARG_NUM
 
+/* variable length: only command up to and including its NUL is sent */
 struct comm_event {
     int pid;
     char parent_proc[16];
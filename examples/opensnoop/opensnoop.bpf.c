@@ -5,10 +5,16 @@
 #include <bpf/bpf_helpers.h>
 #include "opensnoop.h"
 
+#define MAX_EVENT_SIZE sizeof(struct event)
+#include "compat.bpf.h"
+
 const volatile pid_t targ_pid = 0;
 const volatile pid_t targ_tgid = 0;
 const volatile uid_t targ_uid = 0;
 const volatile bool targ_failed = false;
+/* process name filter, matched anywhere in the comm like strstr(3); an empty
+ * name traces every process */
+const volatile char targ_comm[TASK_COMM_LEN] = {};
 
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
@@ -17,16 +23,36 @@ struct {
     __type(value, struct args_t);
 } start SEC(".maps");
 
-struct {
-    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-    __uint(key_size, sizeof(u32));
-    __uint(value_size, sizeof(u32));
-} events SEC(".maps");
+/* unused, the events are built in heap: only puts struct event in the BTF,
+ * where harness/binlog.py reads its layout from */
+struct event *_event __attribute__((unused));
 
 static __always_inline bool valid_uid(uid_t uid) {
     return uid != INVALID_UID;
 }
 
+static __always_inline bool comm_allowed(void) {
+    char comm[TASK_COMM_LEN];
+    int i, j;
+
+    if (!targ_comm[0])
+        return true;
+    bpf_get_current_comm(&comm, sizeof(comm));
+#pragma unroll
+    for (i = 0; i < TASK_COMM_LEN; i++) {
+#pragma unroll
+        for (j = 0; i + j < TASK_COMM_LEN; j++) {
+            if (!targ_comm[j])
+                return true;
+            if (comm[i + j] != targ_comm[j])
+                break;
+        }
+        if (!comm[i])
+            break;
+    }
+    return false;
+}
+
 static __always_inline bool trace_allowed(u32 tgid, u32 pid) {
     u32 uid;
 
@@ -41,6 +67,9 @@ static __always_inline bool trace_allowed(u32 tgid, u32 pid) {
             return false;
         }
     }
+    /* last, it is the most expensive one */
+    if (!comm_allowed())
+        return false;
     return true;
 }
 
@@ -81,9 +110,10 @@ int tracepoint__syscalls__sys_enter_openat(
 }
 
 static __always_inline int trace_exit(struct trace_event_raw_sys_exit* ctx) {
-    struct event event = {};
+    struct event* event;
     struct args_t* ap;
     uintptr_t stack[3];
+    long len;
     int ret;
     u32 pid = bpf_get_current_pid_tgid();
 
@@ -94,22 +124,34 @@ static __always_inline int trace_exit(struct trace_event_raw_sys_exit* ctx) {
     if (targ_failed && ret >= 0)
         goto cleanup; /* want failed only */
 
+    /* the size is only known once fname is read, build it aside */
+    event = heap_buf();
+    if (!event)
+        goto cleanup;
+
     /* event data */
-    event.pid = bpf_get_current_pid_tgid() >> 32;
-    event.uid = bpf_get_current_uid_gid();
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
-    bpf_probe_read_user_str(&event.fname, sizeof(event.fname), ap->fname);
-    event.flags = ap->flags;
-    event.ret = ret;
+    event->ts = bpf_ktime_get_ns();
+    event->pid = bpf_get_current_pid_tgid() >> 32;
+    event->uid = bpf_get_current_uid_gid();
+    bpf_get_current_comm(&event->comm, sizeof(event->comm));
+    len = bpf_probe_read_user_str(&event->fname, sizeof(event->fname),
+                                  ap->fname);
+    if (len <= 0) {
+        event->fname[0] = '\0';
+        len = 1;
+    }
+    if (len > NAME_MAX)
+        len = NAME_MAX;
+    event->flags = ap->flags;
+    event->ret = ret;
 
     bpf_get_stack(ctx, &stack, sizeof(stack), BPF_F_USER_STACK);
     /* Skip the first address that is usually the syscall it-self */
-    event.callers[0] = stack[1];
-    event.callers[1] = stack[2];
+    event->callers[0] = stack[1];
+    event->callers[1] = stack[2];
 
-    /* emit event */
-    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, &event,
-                          sizeof(event));
+    /* emit event, fname only up to its NUL */
+    output_buf(ctx, event, offsetof(struct event, fname) + len);
 
 cleanup:
     bpf_map_delete_elem(&start, &pid);
@@ -6,17 +6,22 @@
 // 14-Feb-2020   Brendan Gregg   Created this.
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
-#ifndef NATIVE_LIBBPF
+#ifdef NATIVE_LIBBPF
+#include <bpf/bpf.h>
+#else
 #include "libbpf-wasm.h"
 #endif
 #include "opensnoop.h"
 #include "opensnoop.skel.h"
+#include "opensnoop.schema.h"
+#include "output.h"
 #include "trace_helpers.h"
 
 #include <sys/types.h>
@@ -25,7 +30,8 @@
 // typedef uint64_t __u64;
 
 /* Tune the buffer size and wakeup rate. These settings cope with roughly
- * 50k opens/sec.
+ * 50k opens/sec. They only apply on kernels before 5.8, newer ones share one
+ * ring buffer of EVENTS_RINGBUF_SIZE between the CPUs, see compat.bpf.h.
  */
 #define PERF_BUFFER_PAGES 64
 #define PERF_BUFFER_TIME_MS 10
@@ -33,6 +39,14 @@
 /* Set the poll timeout when no events occur. This can affect -d accuracy. */
 #define PERF_POLL_TIMEOUT_MS 100
 
+/* Output buffer, flushed when full or after this long */
+#define SINK_SIZE (256 * 1024)
+#define SINK_FLUSH_MS 100
+
+/* Binary log buffer, written out and synced to disk this often */
+#define BINLOG_SIZE (1024 * 1024)
+#define BINLOG_SYNC_MS 1000
+
 #define NSEC_PER_SEC 1000000000ULL
 
 // static volatile sig_atomic_t exiting = 0;
@@ -48,24 +62,57 @@ static struct env {
   bool extended;
   bool failed;
   char *name;
+  bool user_filter;
+  bool summary;
+  const char *binary_out;
 } env = {.uid = INVALID_UID};
 
+/* events that arrived from the buffer, and how many of them were printed */
+static unsigned long long received, printed;
+static unsigned long long lost;
+
+const char argp_program_doc[] =
+    "Trace open family syscalls\n"
+    "\n"
+    "USAGE: opensnoop [-h] [-T] [-U] [-x] [-e] [-p PID] [-t TID] [-u UID]\n"
+    "                 [-d DURATION] [-n NAME] [-N] [-s] [--binary-out FILE]\n"
+    "\n"
+    "  -T  include timestamp on output\n"
+    "  -U  print UID column\n"
+    "  -x  only show failed opens\n"
+    "  -e  show extended fields\n"
+    "  -p  trace this PID only\n"
+    "  -t  trace this TID only\n"
+    "  -u  trace this UID only\n"
+    "  -d  total duration of trace in seconds\n"
+    "  -n  only print process names containing this name, filtered in the\n"
+    "      kernel\n"
+    "  -N  filter -n in user space after the event arrived, like before\n"
+    "  -s  print how many events arrived on exit, to stderr:\n"
+    "      events <n> printed <n> lost <n> drops <n>\n"
+    "      lost by the perf buffer, drops counted by the bpf program\n"
+    "  --binary-out FILE  append the raw events to FILE instead of printing\n"
+    "      them, decode it with python3 -m harness.binlog decode FILE\n";
+
 static int handle_event(void *ctx, void *data, size_t data_sz) {
   const struct event *e = data;
-  struct tm *tm;
-  int sps_cnt;
-  char ts[32];
-  time_t t;
   int fd, err;
 
-  /* name filtering is currently done in user space */
-  if (env.name && strstr(e->comm, env.name) == NULL)
+  /* the record ends after the NUL of fname */
+  if (data_sz < offsetof(struct event, fname))
     return 0;
+  received++;
+  /* -n is matched in the kernel, unless -N asked for the old way */
+  if (env.user_filter && env.name && strstr(e->comm, env.name) == NULL)
+    return 0;
+  printed++;
+
+  if (env.binary_out) {
+    binlog_write(data, data_sz);
+    return 0;
+  }
 
   /* prepare fields */
-  time(&t);
-  tm = localtime(&t);
-  strftime(ts, sizeof(ts), "%H:%M:%S", tm);
   if (e->ret >= 0) {
     fd = e->ret;
     err = 0;
@@ -74,35 +121,129 @@ static int handle_event(void *ctx, void *data, size_t data_sz) {
     err = -e->ret;
   }
 
-  /* print output */
-  sps_cnt = 0;
+  /* print output, into the sink: no printf per column */
   if (env.timestamp) {
-    printf("%-8s ", ts);
-    sps_cnt += 9;
+    sink_str(sink_time(), -8);
+    sink_char(' ');
   }
   if (env.print_uid) {
-    printf("%-7d ", e->uid);
-    sps_cnt += 8;
+    sink_int(e->uid, -7);
+    sink_char(' ');
   }
-  printf("%-6d %-16s %3d %3d ", e->pid, e->comm, fd, err);
-  sps_cnt += 7 + 17 + 4 + 4;
+  sink_int(e->pid, -6);
+  sink_char(' ');
+  sink_strn(e->comm, sizeof(e->comm), -16);
+  sink_char(' ');
+  sink_int(fd, 3);
+  sink_char(' ');
+  sink_int(err, 3);
+  sink_char(' ');
   if (env.extended) {
-    printf("%08o ", e->flags);
-    sps_cnt += 9;
+    sink_oct((unsigned int)e->flags, 8);
+    sink_char(' ');
   }
-  printf("%s\n", e->fname);
+  sink_strn(e->fname, data_sz - offsetof(struct event, fname), 0);
+  sink_char('\n');
   return 0;
 }
 static void handle_event_wrapper(void *ctx, int cpu, void *data,
                                  unsigned int data_sz) {
   handle_event(ctx, data, data_sz);
 }
-static void lost_event(void *a, int b, unsigned long long c) {}
+/* perf buffer only, drops in compat.bpf.h counts full buffers of both kinds */
+static void lost_event(void *a, int b, unsigned long long c) { lost += c; }
+
+/* events the bpf program could not put in a full buffer */
+static unsigned long long read_drops(struct opensnoop_bpf *obj) {
+  unsigned int zero = 0;
+  unsigned long long drops = 0;
+
+  bpf_map_lookup_elem(bpf_map__fd(obj->maps.drops), &zero, &drops);
+  return drops;
+}
+
+static int parse_args(int argc, char *argv[]) {
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      printf("%s", argp_program_doc);
+      exit(0);
+    }
+    if (strcmp(arg, "-T") == 0) {
+      env.timestamp = true;
+      continue;
+    }
+    if (strcmp(arg, "-U") == 0) {
+      env.print_uid = true;
+      continue;
+    }
+    if (strcmp(arg, "-x") == 0) {
+      env.failed = true;
+      continue;
+    }
+    if (strcmp(arg, "-e") == 0) {
+      env.extended = true;
+      continue;
+    }
+    if (strcmp(arg, "-N") == 0) {
+      env.user_filter = true;
+      continue;
+    }
+    if (strcmp(arg, "-s") == 0) {
+      env.summary = true;
+      continue;
+    }
+    if (strcmp(arg, "-v") == 0) {
+      env.verbose = true;
+      continue;
+    }
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return -1;
+    }
+    i++;
+    if (strcmp(arg, "-p") == 0) {
+      env.pid = atoi(val);
+    } else if (strcmp(arg, "-t") == 0) {
+      env.tid = atoi(val);
+    } else if (strcmp(arg, "-u") == 0) {
+      env.uid = strtoul(val, NULL, 10);
+    } else if (strcmp(arg, "-d") == 0) {
+      env.duration = atoi(val);
+    } else if (strcmp(arg, "-n") == 0) {
+      env.name = (char *)val;
+    } else if (strcmp(arg, "--binary-out") == 0) {
+      env.binary_out = val;
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return -1;
+    }
+  }
+  if (env.name && strlen(env.name) >= TASK_COMM_LEN) {
+    fprintf(stderr, "name must be shorter than %d characters\n",
+            TASK_COMM_LEN);
+    return -1;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
   struct opensnoop_bpf *obj;
+#ifdef NATIVE_LIBBPF
+  struct ring_buffer *rb = NULL;
+  struct perf_buffer *pb = NULL;
+#else
+  struct bpf_buffer *buf = NULL;
+#endif
   unsigned long time_end = 0;
   int err;
 
+  if (parse_args(argc, argv))
+    return 1;
+
   obj = opensnoop_bpf__open();
   if (!obj) {
     fprintf(stdout, "failed to open BPF object\n");
@@ -113,6 +254,8 @@ int main(int argc, char **argv) {
   obj->rodata->targ_pid = env.tid;
   obj->rodata->targ_uid = env.uid;
   obj->rodata->targ_failed = env.failed;
+  if (env.name && !env.user_filter)
+    strncpy((char *)obj->rodata->targ_comm, env.name, TASK_COMM_LEN - 1);
 
   /* aarch64 and riscv64 don't have open syscall */
   if (!tracepoint_exists("syscalls", "sys_enter_open")) {
@@ -122,6 +265,19 @@ int main(int argc, char **argv) {
                               false);
   }
 
+#ifdef NATIVE_LIBBPF
+  /* no ring buffer before 5.8, the bpf side falls back to the perf buffer
+   * along with it; the wasm runtime can not change the map type, the wasm
+   * build picks it at compile time instead */
+  if (bpf_map__type(obj->maps.events) == BPF_MAP_TYPE_RINGBUF &&
+      !probe_ringbuf()) {
+    bpf_map__set_type(obj->maps.events, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+    bpf_map__set_key_size(obj->maps.events, sizeof(int));
+    bpf_map__set_value_size(obj->maps.events, sizeof(int));
+    bpf_map__set_max_entries(obj->maps.events, libbpf_num_possible_cpus());
+  }
+#endif
+
   err = opensnoop_bpf__load(obj);
   if (err) {
     fprintf(stdout, "failed to load BPF object: %d\n", err);
@@ -134,30 +290,46 @@ int main(int argc, char **argv) {
     goto cleanup;
   }
   printf("attach ok\n");
+  if (env.binary_out) {
+    err = binlog_open(env.binary_out, event_schema, BINLOG_SIZE,
+                      BINLOG_SYNC_MS);
+    if (err) {
+      fprintf(stderr, "failed to open %s: %s\n", env.binary_out,
+              err == -EINVAL ? "written with another schema" : strerror(-err));
+      goto cleanup;
+    }
+  }
   /* print headers */
-  if (env.timestamp)
-    printf("%-8s ", "TIME");
-  if (env.print_uid)
-    printf("%-7s ", "UID");
-  printf("%-6s %-16s %3s %3s ", "PID", "COMM", "FD", "ERR");
-  if (env.extended)
-    printf("%-8s ", "FLAGS");
-  printf("%s", "PATH");
-  printf("\n");
+  if (!env.binary_out) {
+    if (env.timestamp)
+      printf("%-8s ", "TIME");
+    if (env.print_uid)
+      printf("%-7s ", "UID");
+    printf("%-6s %-16s %3s %3s ", "PID", "COMM", "FD", "ERR");
+    if (env.extended)
+      printf("%-8s ", "FLAGS");
+    printf("%s", "PATH");
+    printf("\n");
+  }
+  fflush(stdout);
+  if (sink_init(SINK_SIZE, SINK_FLUSH_MS))
+    fprintf(stderr, "no output buffer, falling back to stdio\n");
 
 /* setup event callbacks */
 #ifdef NATIVE_LIBBPF
-  struct perf_buffer *buf =
-      perf_buffer__new(bpf_map__fd(obj->maps.events), PERF_BUFFER_PAGES,
-                       handle_event_wrapper, lost_event, NULL, NULL);
+  if (bpf_map__type(obj->maps.events) == BPF_MAP_TYPE_RINGBUF)
+    rb = ring_buffer__new(bpf_map__fd(obj->maps.events), handle_event, NULL,
+                          NULL);
+  else
+    pb = perf_buffer__new(bpf_map__fd(obj->maps.events), PERF_BUFFER_PAGES,
+                          handle_event_wrapper, lost_event, NULL, NULL);
+  if (!rb && !pb) {
 #else
-  struct bpf_buffer *buf =
-      bpf_buffer__open(obj->maps.events, handle_event, NULL);
-#endif
-
+  buf = bpf_buffer__open(obj->maps.events, handle_event, NULL);
   if (!buf) {
+#endif
     err = -errno;
-    fprintf(stdout, "failed to open perf buffer: %d\n", err);
+    fprintf(stdout, "failed to open event buffer: %d\n", err);
     goto cleanup;
   }
 
@@ -168,14 +340,19 @@ int main(int argc, char **argv) {
   /* main: poll */
   while (true) {
 #ifdef NATIVE_LIBBPF
-    err = perf_buffer__poll(buf, PERF_POLL_TIMEOUT_MS);
+    if (rb)
+      err = ring_buffer__poll(rb, PERF_POLL_TIMEOUT_MS);
+    else
+      err = perf_buffer__poll(pb, PERF_POLL_TIMEOUT_MS);
 #else
     err = bpf_buffer__poll(buf, PERF_POLL_TIMEOUT_MS);
 #endif
     if (err < 0 && err != -EINTR) {
-      fprintf(stdout, "error polling perf buffer: %s\n", strerror(-err));
+      fprintf(stdout, "error polling event buffer: %s\n", strerror(-err));
       goto cleanup;
     }
+    sink_tick();
+    binlog_tick();
     if (env.duration && get_ktime_ns() > time_end)
       goto cleanup;
     /* reset err to return 0 if exiting */
@@ -183,11 +360,17 @@ int main(int argc, char **argv) {
   }
 
 cleanup:
+  sink_flush();
+  binlog_close();
+  if (env.summary)
+    fprintf(stderr, "events %llu printed %llu lost %llu drops %llu\n",
+            received, printed, lost, read_drops(obj));
 #ifdef NATIVE_LIBBPF
-  perf_buffer__free(buf);
-
+  ring_buffer__free(rb);
+  perf_buffer__free(pb);
 #else
-  bpf_buffer__free(buf);
+  if (buf)
+    bpf_buffer__free(buf);
 #endif
   opensnoop_bpf__destroy(obj);
   return err != 0;
@@ -12,6 +12,7 @@ struct args_t {
     int flags;
 };
 
+/* variable length: only fname up to and including its NUL is sent */
 struct event {
     /* user terminology for pid: */
     unsigned long long ts;
@@ -20,6 +20,8 @@
 #include "trace_helpers.h"
 #ifndef NATIVE_LIBBPF
 #include "libbpf-wasm.h"
+#else
+#include <bpf/bpf.h>
 #endif
 #define min(x, y)                      \
     ({                                 \
@@ -239,12 +241,17 @@ bool probe_tp_btf(const char* name) {
 }
 
 bool probe_ringbuf() {
+#ifdef NATIVE_LIBBPF
     int map_fd;
 
-    // map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, getpagesize(), NULL);
-    // if (map_fd < 0)
-    // 	return false;
+    map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, getpagesize(), NULL);
+    if (map_fd < 0)
+        return false;
 
-    // close(map_fd);
+    close(map_fd);
+    return true;
+#else
+    /* the guest can not create maps on its own */
     return false;
+#endif
 }
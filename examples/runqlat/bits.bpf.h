@@ -33,4 +33,16 @@ static __always_inline u64 log2l(u64 v) {
         return log2(v);
 }
 
+/* slot of v in a log-linear histogram: values below 2^sub_bits get a slot
+ * each, above that every power of two is split into 2^sub_bits equal
+ * slots, picked by the bits after the leading one */
+static __always_inline u64 log_linear_slot(u64 v, u32 sub_bits) {
+    u64 shift;
+
+    if (v < (1ULL << sub_bits))
+        return v;
+    shift = log2l(v) - sub_bits;
+    return ((shift + 1) << sub_bits) + ((v >> shift) & ((1ULL << sub_bits) - 1));
+}
+
 #endif /* __BITS_BPF_H */
@@ -9,14 +9,25 @@
 #include "maps.bpf.h"
 #include "core_fixes.bpf.h"
 
-#define MAX_ENTRIES 10240
 #define TASK_RUNNING 0
+/* the vmlinux.h in third_party predates task storage (5.11) */
+#define TASK_STORAGE_MAP_TYPE 29    /* BPF_MAP_TYPE_TASK_STORAGE */
+#define TASK_STORAGE_GET_F_CREATE 1 /* BPF_LOCAL_STORAGE_GET_F_CREATE */
 
 const volatile bool filter_cg = false;
 const volatile bool targ_per_process = false;
 const volatile bool targ_per_thread = false;
 const volatile bool targ_per_pidns = false;
 const volatile bool targ_ms = false;
+/* count into hists_percpu, each CPU its own copy, instead of hists */
+const volatile bool targ_percpu = false;
+/* keep the wakeup timestamps in task_start instead of the start hash */
+const volatile bool use_task_storage = false;
+
+/* selects the histogram copy the programs count into, 0 for hists (or
+ * hists_percpu) and 1 for hists_alt (hists_percpu_alt). Userspace flips it
+ * at every interval and then reads and clears the copy nobody writes. */
+u32 epoch SEC(".data.epoch") = 0;
 const volatile pid_t targ_tgid = 0;
 
 struct {
@@ -33,6 +44,23 @@ struct {
     __type(value, u64);
 } start SEC(".maps");
 
+/* the wakeup timestamp in the task itself, 0 when none is pending: no hash
+ * lookup and delete per switch and no wakeups lost to a full map. Userspace
+ * turns it into a one entry hash where the kernel lacks task storage; the
+ * wasm sdk can not, so the wasm build for such kernels is made with
+ * `make TASK_STORAGE=0`. */
+struct {
+#ifdef RUNQLAT_NO_TASK_STORAGE
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1);
+#else
+    __uint(type, TASK_STORAGE_MAP_TYPE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+#endif
+    __type(key, int);
+    __type(value, u64);
+} task_start SEC(".maps");
+
 static struct hist zero;
 
 struct {
@@ -42,8 +70,33 @@ struct {
     __type(value, struct hist);
 } hists SEC(".maps");
 
-static int trace_enqueue(u32 tgid, u32 pid) {
-    u64 ts;
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, u32);
+    __type(value, struct hist);
+} hists_alt SEC(".maps");
+
+/* allocated per key on first use, a preallocated map would reserve
+ * MAX_ENTRIES histograms for every possible CPU up front */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, u32);
+    __type(value, struct hist);
+} hists_percpu SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, u32);
+    __type(value, struct hist);
+} hists_percpu_alt SEC(".maps");
+
+static int trace_enqueue(struct task_struct* p, u32 tgid, u32 pid) {
+    u64 ts, *tsp;
 
     if (!pid)
         return 0;
@@ -51,6 +104,13 @@ static int trace_enqueue(u32 tgid, u32 pid) {
         return 0;
 
     ts = bpf_ktime_get_ns();
+    if (use_task_storage) {
+        tsp = bpf_task_storage_get(&task_start, p, 0,
+                                   TASK_STORAGE_GET_F_CREATE);
+        if (tsp)
+            *tsp = ts;
+        return 0;
+    }
     bpf_map_update_elem(&start, &pid, &ts, BPF_ANY);
     return 0;
 }
@@ -77,19 +137,23 @@ static int handle_switch(bool preempt,
                          struct task_struct* next) {
     struct hist* histp;
     u64 *tsp, slot;
-    u32 pid, hkey;
+    u32 pid, hkey, cur;
     s64 delta;
 
     if (filter_cg && !bpf_current_task_under_cgroup(&cgroup_map, 0))
         return 0;
 
     if (get_task_state(prev) == TASK_RUNNING)
-        trace_enqueue(BPF_CORE_READ(prev, tgid), BPF_CORE_READ(prev, pid));
+        trace_enqueue(prev, BPF_CORE_READ(prev, tgid),
+                      BPF_CORE_READ(prev, pid));
 
     pid = BPF_CORE_READ(next, pid);
 
-    tsp = bpf_map_lookup_elem(&start, &pid);
-    if (!tsp)
+    if (use_task_storage)
+        tsp = bpf_task_storage_get(&task_start, next, 0, 0);
+    else
+        tsp = bpf_map_lookup_elem(&start, &pid);
+    if (!tsp || !*tsp)
         return 0;
     delta = bpf_ktime_get_ns() - *tsp;
     if (delta < 0)
@@ -103,7 +167,15 @@ static int handle_switch(bool preempt,
         hkey = pid_namespace(next);
     else
         hkey = -1;
-    histp = bpf_map_lookup_or_try_init(&hists, &hkey, &zero);
+    cur = READ_ONCE(epoch) & 1;
+    if (targ_percpu && cur)
+        histp = bpf_map_lookup_or_try_init(&hists_percpu_alt, &hkey, &zero);
+    else if (targ_percpu)
+        histp = bpf_map_lookup_or_try_init(&hists_percpu, &hkey, &zero);
+    else if (cur)
+        histp = bpf_map_lookup_or_try_init(&hists_alt, &hkey, &zero);
+    else
+        histp = bpf_map_lookup_or_try_init(&hists, &hkey, &zero);
     if (!histp)
         goto cleanup;
     if (!histp->comm[0])
@@ -113,13 +185,25 @@ static int handle_switch(bool preempt,
         delta /= 1000000U;
     else
         delta /= 1000U;
+#ifdef RUNQLAT_LOGLINEAR
+    slot = log_linear_slot(delta, HIST_SUB_BITS);
+#else
     slot = log2l(delta);
-    if (slot >= MAX_SLOTS)
-        slot = MAX_SLOTS - 1;
-    __sync_fetch_and_add(&histp->slots[slot], 1);
+#endif
+    if (slot >= HIST_SLOTS)
+        slot = HIST_SLOTS - 1;
+    /* the program can not migrate and does not nest on one CPU, so the
+     * per-CPU copy needs no atomic and its cache line stays local */
+    if (targ_percpu)
+        histp->slots[slot]++;
+    else
+        __sync_fetch_and_add(&histp->slots[slot], 1);
 
 cleanup:
-    bpf_map_delete_elem(&start, &pid);
+    if (use_task_storage)
+        *tsp = 0;
+    else
+        bpf_map_delete_elem(&start, &pid);
     return 0;
 }
 
@@ -128,7 +212,7 @@ int BPF_PROG(sched_wakeup, struct task_struct* p) {
     if (filter_cg && !bpf_current_task_under_cgroup(&cgroup_map, 0))
         return 0;
 
-    return trace_enqueue(p->tgid, p->pid);
+    return trace_enqueue(p, p->tgid, p->pid);
 }
 
 SEC("tp_btf/sched_wakeup_new")
@@ -136,7 +220,7 @@ int BPF_PROG(sched_wakeup_new, struct task_struct* p) {
     if (filter_cg && !bpf_current_task_under_cgroup(&cgroup_map, 0))
         return 0;
 
-    return trace_enqueue(p->tgid, p->pid);
+    return trace_enqueue(p, p->tgid, p->pid);
 }
 
 SEC("tp_btf/sched_switch")
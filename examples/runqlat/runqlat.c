@@ -6,6 +6,7 @@
 // #include <signal.h>
 
 #include "trace_helpers.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -27,9 +28,12 @@ struct env {
   bool verbose;
   char *cgroupspath;
   bool cg;
+  bool percpu;
+  bool task_storage;
 } env = {
     .interval = 1,
     .times = 99999999,
+    .task_storage = true,
 };
 
 static volatile bool exiting;
@@ -40,17 +44,19 @@ const char *argp_program_bug_address =
 const char argp_program_doc[] =
     "Summarize run queue (scheduler) latency as a histogram.\n"
     "\n"
-    "USAGE: runqlat [--help] [-T] [-m] [--pidnss] [-L] [-P] [-p PID] "
-    "[interval] [count] [-c CG]\n"
+    "USAGE: runqlat [--help] [-T] [-m] [--pidnss] [-L] [-P] [-v] [-p PID] "
+    "[--percpu] [--no-task-storage] [interval] [count] [-c CG]\n"
     "\n"
     "EXAMPLES:\n"
     "    runqlat         # summarize run queue latency as a histogram\n"
     "    runqlat 1 10    # print 1 second summaries, 10 times\n"
+    "    runqlat -mT 1   # 1s summaries, milliseconds, and timestamps\n"
     "    runqlat -P      # show each PID separately\n"
     "    runqlat -p 185  # trace PID 185 only\n"
-    "    runqlat -c CG   # Trace process under cgroupsPath CG\n";
-
-#define OPT_PIDNSS 1 /* --pidnss */
+    "    runqlat -c CG   # Trace process under cgroupsPath CG\n"
+    "    runqlat --percpu # count per CPU, no atomics in sched_switch\n"
+    "    runqlat --no-task-storage # wakeup times in a hash, not the task\n"
+    "    runqlat -v      # print the libbpf log, e.g. why task storage failed\n";
 
 static void print_usage(void) {
   printf("%s\n", argp_program_version);
@@ -59,40 +65,239 @@ static void print_usage(void) {
 
 static void sig_handler(int sig) { exiting = true; }
 
+static int parse_args(int argc, char **argv) {
+  int positional = 0;
+
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      print_usage();
+      exit(0);
+    } else if (strcmp(arg, "--pidnss") == 0) {
+      env.per_pidns = true;
+    } else if (strcmp(arg, "--percpu") == 0) {
+      env.percpu = true;
+    } else if (strcmp(arg, "--no-task-storage") == 0) {
+      env.task_storage = false;
+    } else if (strcmp(arg, "-p") == 0 || strcmp(arg, "-c") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "missing value for %s\n", arg);
+        return -1;
+      }
+      if (arg[1] == 'p') {
+        env.pid = atoi(argv[++i]);
+      } else {
+        env.cgroupspath = argv[++i];
+        env.cg = true;
+      }
+    } else if (arg[0] == '-' && arg[1]) {
+      /* flags may be combined, e.g. -mT */
+      for (const char *c = arg + 1; *c; c++) {
+        if (*c == 'T') {
+          env.timestamp = true;
+        } else if (*c == 'm') {
+          env.milliseconds = true;
+        } else if (*c == 'P') {
+          env.per_process = true;
+        } else if (*c == 'L') {
+          env.per_thread = true;
+        } else if (*c == 'v') {
+          env.verbose = true;
+        } else {
+          fprintf(stderr, "unknown option %s\n", arg);
+          return -1;
+        }
+      }
+    } else if (positional == 0) {
+      env.interval = atoi(arg);
+      positional++;
+    } else if (positional == 1) {
+      env.times = atoi(arg);
+      positional++;
+    } else {
+      fprintf(stderr, "unrecognized positional argument: %s\n", arg);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* a per-CPU lookup returns one value per possible CPU, each padded to 8
+ * bytes */
+#define HIST_PERCPU_STRIDE ((sizeof(struct hist) + 7) & ~(size_t)7)
+
+static struct hist *percpu_hists;
+static int nr_cpus;
+
+/* read the histogram of key, summing the copies of all CPUs in --percpu
+ * mode */
+static int lookup_hist(int fd, uint32_t *key, struct hist *hist) {
+  int err;
+
+  if (!env.percpu)
+    return bpf_map_lookup_elem(fd, key, hist);
+  err = bpf_map_lookup_elem(fd, key, percpu_hists);
+  if (err < 0)
+    return err;
+  memset(hist, 0, sizeof(*hist));
+  for (int cpu = 0; cpu < nr_cpus; cpu++) {
+    const struct hist *h =
+        (const void *)((const char *)percpu_hists + cpu * HIST_PERCPU_STRIDE);
+
+    for (int i = 0; i < HIST_SLOTS; i++)
+      hist->slots[i] += h->slots[i];
+    if (!hist->comm[0] && h->comm[0])
+      memcpy(hist->comm, h->comm, sizeof(hist->comm));
+  }
+  return 0;
+}
+
+/* zero the counts of key in place, keeping comm, so the next switch does not
+ * have to create the entry again; in --percpu mode percpu_hists must still
+ * hold what lookup_hist() read for key */
+static int clear_hist(int fd, uint32_t *key, struct hist *hist) {
+  if (!env.percpu) {
+    memset(hist->slots, 0, sizeof(hist->slots));
+    return bpf_map_update_elem(fd, key, hist, BPF_EXIST);
+  }
+  for (int cpu = 0; cpu < nr_cpus; cpu++) {
+    struct hist *h = (void *)((char *)percpu_hists + cpu * HIST_PERCPU_STRIDE);
+
+    memset(h->slots, 0, sizeof(h->slots));
+  }
+  return bpf_map_update_elem(fd, key, percpu_hists, BPF_EXIST);
+}
+
+static bool hist_empty(const struct hist *hist) {
+  for (int i = 0; i < HIST_SLOTS; i++)
+    if (hist->slots[i])
+      return false;
+  return true;
+}
+
+/* the copy of the histograms the programs count into, see epoch in
+ * runqlat.bpf.c */
+static uint32_t epoch;
+
+static int flip_epoch(struct runqlat_bpf *obj) {
+  epoch ^= 1;
+#ifdef NATIVE_LIBBPF
+  __atomic_store_n(&obj->data_epoch->epoch, epoch, __ATOMIC_RELEASE);
+  return 0;
+#else
+  /* the wasm skeleton does not map the global data, write it through the
+   * map holding the section */
+  uint32_t zero = 0;
+
+  return bpf_map_update_elem(bpf_map__fd(obj->maps.data_epoch), &zero, &epoch,
+                             BPF_ANY);
+#endif
+}
+
+/* the copy nobody counts into after flip_epoch() */
+static struct bpf_map *idle_hists(struct runqlat_bpf *obj) {
+  if (env.percpu)
+    return epoch ? obj->maps.hists_percpu : obj->maps.hists_percpu_alt;
+  return epoch ? obj->maps.hists : obj->maps.hists_alt;
+}
+
+static uint32_t hist_keys[MAX_ENTRIES];
+
+/* print and clear the histograms of the idle copy; keys that saw no switch
+ * in the last interval belong to tasks that are gone or asleep and are
+ * deleted so the map does not fill up. The keys are collected first, an
+ * update moves the entry within its hash bucket and would upset
+ * bpf_map_get_next_key(). */
 static int print_log2_hists(struct bpf_map *hists) {
   const char *units = env.milliseconds ? "msecs" : "usecs";
   int err, fd = bpf_map__fd(hists);
   uint32_t lookup_key = -2, next_key;
   struct hist hist;
+  int key_cnt = 0;
+
+  while (key_cnt < MAX_ENTRIES &&
+         !bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+    hist_keys[key_cnt++] = next_key;
+    lookup_key = next_key;
+  }
 
-  while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-    err = bpf_map_lookup_elem(fd, &next_key, &hist);
+  for (int i = 0; i < key_cnt; i++) {
+    err = lookup_hist(fd, &hist_keys[i], &hist);
     if (err < 0) {
       fprintf(stderr, "failed to lookup hist: %d\n", err);
       return -1;
     }
+    if (hist_empty(&hist)) {
+      err = bpf_map_delete_elem(fd, &hist_keys[i]);
+      if (err < 0) {
+        fprintf(stderr, "failed to cleanup hist : %d\n", err);
+        return -1;
+      }
+      continue;
+    }
     if (env.per_process)
-      printf("\npid = %d %s\n", next_key, hist.comm);
+      printf("\npid = %d %s\n", hist_keys[i], hist.comm);
     else if (env.per_thread)
-      printf("\ntid = %d %s\n", next_key, hist.comm);
+      printf("\ntid = %d %s\n", hist_keys[i], hist.comm);
     else if (env.per_pidns)
-      printf("\npidns = %u %s\n", next_key, hist.comm);
+      printf("\npidns = %u %s\n", hist_keys[i], hist.comm);
+#ifdef RUNQLAT_LOGLINEAR
+    print_log_linear_hist(hist.slots, HIST_SLOTS, HIST_SUB_BITS, units);
+    print_log_linear_percentiles(hist.slots, HIST_SLOTS, HIST_SUB_BITS, units);
+#else
     print_log2_hist(hist.slots, MAX_SLOTS, units);
-    lookup_key = next_key;
-  }
-
-  lookup_key = -2;
-  while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-    err = bpf_map_delete_elem(fd, &next_key);
+#endif
+    err = clear_hist(fd, &hist_keys[i], &hist);
     if (err < 0) {
-      fprintf(stderr, "failed to cleanup hist : %d\n", err);
+      fprintf(stderr, "failed to clear hist: %d\n", err);
       return -1;
     }
-    lookup_key = next_key;
   }
   return 0;
 }
 
+/* open and load the object, with the wakeup times in task storage or in the
+ * start hash */
+static struct runqlat_bpf *load_runqlat(bool task_storage, int *err) {
+  struct runqlat_bpf *obj;
+
+  obj = runqlat_bpf__open();
+  if (!obj) {
+    *err = -errno;
+    return NULL;
+  }
+
+  /* initialize global data (filtering options) */
+  obj->rodata->targ_per_process = env.per_process;
+  obj->rodata->targ_per_thread = env.per_thread;
+  obj->rodata->targ_per_pidns = env.per_pidns;
+  obj->rodata->targ_ms = env.milliseconds;
+  obj->rodata->targ_tgid = env.pid;
+  obj->rodata->filter_cg = env.cg;
+  obj->rodata->targ_percpu = env.percpu;
+  obj->rodata->use_task_storage = task_storage;
+#ifdef NATIVE_LIBBPF
+  /* shrink the map that is not used; task_start has to become a hash where
+   * the kernel can not create task storage */
+  if (task_storage) {
+    bpf_map__set_max_entries(obj->maps.start, 1);
+  } else {
+    bpf_map__set_type(obj->maps.task_start, BPF_MAP_TYPE_HASH);
+    bpf_map__set_map_flags(obj->maps.task_start, 0);
+    bpf_map__set_max_entries(obj->maps.task_start, 1);
+  }
+#endif
+
+  *err = runqlat_bpf__load(obj);
+  if (*err) {
+    runqlat_bpf__destroy(obj);
+    return NULL;
+  }
+  return obj;
+}
+
 int main(int argc, char **argv) {
   struct runqlat_bpf *obj;
   struct tm *tm;
@@ -101,20 +306,12 @@ int main(int argc, char **argv) {
   int err;
   int idx, cg_map_fd;
   int cgfd = -1;
+#ifdef NATIVE_LIBBPF
+  libbpf_print_fn_t print = NULL;
+#endif
 
-  // parse the args manually for demo purpose
-  if (argc > 3 || (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
-                                 strcmp(argv[1], "--help") == 0))) {
-    print_usage();
-    return 0;
-  } else if (argc == 2 && strcmp(argv[1], "-P")) {
-    env.per_process = true;
-  } else if (argc == 3) {
-    env.interval = atoi(argv[1]);
-    env.times = atoi(argv[2]);
-  } else if (argc == 2) {
-    env.interval = atoi(argv[1]);
-  }
+  if (parse_args(argc, argv))
+    return 1;
   if ((env.per_thread && (env.per_process || env.per_pidns)) ||
       (env.per_process && env.per_pidns)) {
     fprintf(stderr, "pidnss, pids, tids cann't be used together.\n");
@@ -123,25 +320,48 @@ int main(int argc, char **argv) {
   if (!env.interval) {
     env.interval = 1;
   }
-
-  obj = runqlat_bpf__open();
-  if (!obj) {
-    fprintf(stderr, "failed to open BPF object\n");
-    return 1;
+  if (env.percpu) {
+    nr_cpus = libbpf_num_possible_cpus();
+    if (nr_cpus < 0) {
+      fprintf(stderr, "failed to get the number of possible cpus: %d\n",
+              nr_cpus);
+      return 1;
+    }
+    percpu_hists = calloc(nr_cpus, HIST_PERCPU_STRIDE);
+    if (!percpu_hists) {
+      fprintf(stderr, "failed to allocate the per-cpu histograms\n");
+      return 1;
+    }
   }
 
-  /* initialize global data (filtering options) */
-  obj->rodata->targ_per_process = env.per_process;
-  obj->rodata->targ_per_thread = env.per_thread;
-  obj->rodata->targ_per_pidns = env.per_pidns;
-  obj->rodata->targ_ms = env.milliseconds;
-  obj->rodata->targ_tgid = env.pid;
-  obj->rodata->filter_cg = env.cg;
-
-  err = runqlat_bpf__load(obj);
-  if (err) {
+#if !defined(NATIVE_LIBBPF) && defined(RUNQLAT_NO_TASK_STORAGE)
+  env.task_storage = false;
+#endif
+#ifdef NATIVE_LIBBPF
+  /* tracing programs can use task storage from 5.12 on and libbpf has no
+   * probe for helpers in them: try quietly, and keep the wakeup times in the
+   * start hash where the kernel refuses */
+  if (env.task_storage && !env.verbose)
+    print = libbpf_set_print(NULL);
+  obj = load_runqlat(env.task_storage, &err);
+  if (env.task_storage && !env.verbose)
+    libbpf_set_print(print);
+  if (!obj && env.task_storage) {
+    fprintf(stderr, "no task storage, keeping wakeup times in a hash\n");
+    env.task_storage = false;
+    obj = load_runqlat(false, &err);
+  }
+#else
+  obj = load_runqlat(env.task_storage, &err);
+#endif
+  if (!obj) {
     fprintf(stderr, "failed to load BPF object: %d\n", err);
-    goto cleanup;
+#if !defined(NATIVE_LIBBPF) && !defined(RUNQLAT_NO_TASK_STORAGE)
+    fprintf(stderr, "kernels before 5.12 need a build with "
+                    "`make TASK_STORAGE=0`\n");
+#endif
+    free(percpu_hists);
+    return 1;
   }
 
   /* update cgroup path fd to map */
@@ -179,7 +399,15 @@ int main(int argc, char **argv) {
       printf("%-8s\n", ts);
     }
 
-    err = print_log2_hists(obj->maps.hists);
+    err = flip_epoch(obj);
+    if (err) {
+      fprintf(stderr, "failed to flip the histogram epoch: %d\n", err);
+      break;
+    }
+    /* let the programs that read the old epoch finish their update; they
+     * run with preemption disabled and take well under a microsecond */
+    usleep(1000);
+    err = print_log2_hists(idle_hists(obj));
     if (err)
       break;
 
@@ -191,6 +419,7 @@ cleanup:
   runqlat_bpf__destroy(obj);
   if (cgfd > 0)
     close(cgfd);
+  free(percpu_hists);
 
   return err != 0;
 }
@@ -4,9 +4,20 @@
 
 #define TASK_COMM_LEN 16
 #define MAX_SLOTS 26
+#define MAX_ENTRIES 10240
+
+/* built with RUNQLAT_LOGLINEAR every power of two of the MAX_SLOTS log2
+ * slots is split into 2^HIST_SUB_BITS linear slots, see log_linear_slot()
+ * in bits.bpf.h, so the bucket width stays below 1/8 of the value */
+#ifdef RUNQLAT_LOGLINEAR
+#define HIST_SUB_BITS 3
+#define HIST_SLOTS ((MAX_SLOTS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#else
+#define HIST_SLOTS MAX_SLOTS
+#endif
 
 struct hist {
-    unsigned int slots[MAX_SLOTS];
+    unsigned int slots[HIST_SLOTS];
     char comm[TASK_COMM_LEN];
 } __attribute__((packed));
 
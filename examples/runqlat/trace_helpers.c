@@ -20,6 +20,9 @@
 #include "trace_helpers.h"
 #ifndef NATIVE_LIBBPF
 #include "libbpf-wasm.h"
+#else
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
 #endif
 #define min(x, y)                      \
     ({                                 \
@@ -123,6 +126,93 @@ void print_linear_hist(unsigned int* vals,
     }
 }
 
+static void log_linear_bounds(int slot,
+                              int sub_bits,
+                              unsigned long long* low,
+                              unsigned long long* high) {
+    int sub_count = 1 << sub_bits, shift;
+
+    if (slot < sub_count) {
+        *low = *high = slot;
+        return;
+    }
+    shift = slot / sub_count - 1;
+    *low = (unsigned long long)(sub_count + slot % sub_count) << shift;
+    *high = *low + (1ULL << shift) - 1;
+}
+
+void print_log_linear_hist(unsigned int* vals,
+                           int vals_size,
+                           int sub_bits,
+                           const char* val_type) {
+    int i, stars_max = 40, idx_max = -1;
+    unsigned int val, val_max = 0;
+    unsigned long long low, high;
+
+    for (i = 0; i < vals_size; i++) {
+        val = vals[i];
+        if (val > 0)
+            idx_max = i;
+        if (val > val_max)
+            val_max = val;
+    }
+
+    if (idx_max < 0)
+        return;
+
+    printf("%*s%-*s : count    distribution\n", 5, "", 19, val_type);
+    for (i = 0; i <= idx_max; i++) {
+        val = vals[i];
+        if (!val)
+            continue;
+        log_linear_bounds(i, sub_bits, &low, &high);
+        printf("%*lld -> %-*lld : %-8d |", 10, low, 10, high, val);
+        print_stars(val, val_max, stars_max);
+        printf("|\n");
+    }
+}
+
+/* upper bound of the slot holding the pct percentile */
+static unsigned long long log_linear_percentile(unsigned int* vals,
+                                                int vals_size,
+                                                int sub_bits,
+                                                unsigned long long total,
+                                                double pct) {
+    unsigned long long target, seen = 0, low, high = 0;
+    int i;
+
+    target = (unsigned long long)(pct / 100.0 * total + 0.5);
+    if (target < 1)
+        target = 1;
+    for (i = 0; i < vals_size; i++) {
+        if (!vals[i])
+            continue;
+        seen += vals[i];
+        log_linear_bounds(i, sub_bits, &low, &high);
+        if (seen >= target)
+            break;
+    }
+    return high;
+}
+
+void print_log_linear_percentiles(unsigned int* vals,
+                                  int vals_size,
+                                  int sub_bits,
+                                  const char* val_type) {
+    unsigned long long total = 0;
+    int i;
+
+    for (i = 0; i < vals_size; i++)
+        total += vals[i];
+    if (!total)
+        return;
+    printf("%s p50 %llu p90 %llu p99 %llu p99.9 %llu\n", val_type,
+           log_linear_percentile(vals, vals_size, sub_bits, total, 50),
+           log_linear_percentile(vals, vals_size, sub_bits, total, 90),
+           log_linear_percentile(vals, vals_size, sub_bits, total, 99),
+           log_linear_percentile(vals, vals_size, sub_bits, total, 99.9));
+}
+
 unsigned long long get_ktime_ns(void) {
     struct timespec ts;
 
@@ -239,12 +329,17 @@ bool probe_tp_btf(const char* name) {
 }
 
 bool probe_ringbuf() {
+#ifdef NATIVE_LIBBPF
     int map_fd;
 
-    // map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, getpagesize(), NULL);
-    // if (map_fd < 0)
-    // 	return false;
+    map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, getpagesize(), NULL);
+    if (map_fd < 0)
+        return false;
 
-    // close(map_fd);
+    close(map_fd);
+    return true;
+#else
+    /* the guest can not create maps on its own */
     return false;
+#endif
 }
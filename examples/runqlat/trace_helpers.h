@@ -13,6 +13,16 @@ void print_linear_hist(unsigned int* vals,
                        unsigned int step,
                        const char* val_type);
 
+/* histograms in the layout of log_linear_slot() in bits.bpf.h */
+void print_log_linear_hist(unsigned int* vals,
+                           int vals_size,
+                           int sub_bits,
+                           const char* val_type);
+void print_log_linear_percentiles(unsigned int* vals,
+                                  int vals_size,
+                                  int sub_bits,
+                                  const char* val_type);
+
 unsigned long long get_ktime_ns(void);
 
 bool is_kernel_module(const char* name);
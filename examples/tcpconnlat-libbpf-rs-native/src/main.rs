@@ -1,5 +1,5 @@
 use anyhow::{anyhow, Context};
-use libbpf_rs::{ObjectBuilder, PerfBufferBuilder};
+use libbpf_rs::{MapType, ObjectBuilder, PerfBufferBuilder, RingBufferBuilder};
 use plain::Plain;
 use std::ffi::c_char;
 use std::net::{Ipv4Addr, Ipv6Addr};
@@ -11,9 +11,19 @@ const AF_INET6: i32 = 10;
 
 fn main() -> anyhow::Result<()> {
     let bpf_object = include_bytes!("../tcpconnlat.bpf.o");
-    let mut obj = ObjectBuilder::default()
+    let mut open_obj = ObjectBuilder::default()
         .open_memory(&bpf_object[..])
-        .with_context(|| anyhow!("Failed to open object"))?
+        .with_context(|| anyhow!("Failed to open object"))?;
+    // no ring buffer before 5.8, the bpf side falls back to the perf buffer
+    // along with it
+    if !MapType::RingBuf.is_supported()? {
+        let events = open_obj.map_mut("events").unwrap();
+        events.set_type(MapType::PerfEventArray)?;
+        events.set_key_size(4)?;
+        events.set_value_size(4)?;
+        events.set_max_entries(libbpf_rs::num_possible_cpus()? as u32)?;
+    }
+    let mut obj = open_obj
         .load()
         .with_context(|| anyhow!("Failed to load object"))?;
     // let
@@ -27,15 +37,23 @@ fn main() -> anyhow::Result<()> {
     }
     let map = obj.map("events").unwrap();
     let mut start_ts = 0;
+    println!(
+        "{:<9} {:<6} {:<12} {:<2} {:<16} {:<6} {:<16} {:<5} LAT(ms)",
+        "TIME(s)", "PID", "COMM", "IP", "SADDR", "LPORT", "DADDR", "DPORT"
+    );
+    if map.map_type() == MapType::RingBuf {
+        let mut builder = RingBufferBuilder::new();
+        builder.add(map, |v| handle_event(v, &mut start_ts))?;
+        let ringbuf = builder.build()?;
+        loop {
+            ringbuf.poll(Duration::from_millis(100))?;
+        }
+    }
     let poll = PerfBufferBuilder::new(&map)
         .sample_cb(|_, v| {
             handle_event(v, &mut start_ts);
         })
         .build()?;
-    println!(
-        "{:<9} {:<6} {:<12} {:<2} {:<16} {:<6} {:<16} {:<5} LAT(ms)",
-        "TIME(s)", "PID", "COMM", "IP", "SADDR", "LPORT", "DADDR", "DPORT"
-    );
     loop {
         poll.poll(Duration::from_millis(100))?;
     }
@@ -6,6 +6,9 @@
 #include <bpf/bpf_tracing.h>
 #include "tcpconnlat.h"
 
+#define MAX_EVENT_SIZE sizeof(struct event)
+#include "compat.bpf.h"
+
 #define AF_INET 2
 #define AF_INET6 10
 
@@ -25,12 +28,6 @@ struct {
     __type(value, struct piddata);
 } start SEC(".maps");
 
-struct {
-    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-    __uint(key_size, sizeof(u32));
-    __uint(value_size, sizeof(u32));
-} events SEC(".maps");
-
 static int trace_connect(struct sock* sk) {
     u32 tgid = bpf_get_current_pid_tgid() >> 32;
     struct piddata piddata = {};
@@ -47,7 +44,7 @@ static int trace_connect(struct sock* sk) {
 
 static int handle_tcp_rcv_state_process(void* ctx, struct sock* sk) {
     struct piddata* piddatap;
-    struct event event = {};
+    struct event* event;
     s64 delta;
     u64 ts;
 
@@ -63,26 +60,29 @@ static int handle_tcp_rcv_state_process(void* ctx, struct sock* sk) {
     if (delta < 0)
         goto cleanup;
 
-    event.delta_us = delta / 1000U;
-    if (targ_min_us && event.delta_us < targ_min_us)
+    if (targ_min_us && delta / 1000U < targ_min_us)
+        goto cleanup;
+
+    event = reserve_buf(sizeof(*event));
+    if (!event)
         goto cleanup;
-    __builtin_memcpy(&event.comm, piddatap->comm, sizeof(event.comm));
-    event.ts_us = ts / 1000;
-    event.tgid = piddatap->tgid;
-    event.lport = BPF_CORE_READ(sk, __sk_common.skc_num);
-    event.dport = BPF_CORE_READ(sk, __sk_common.skc_dport);
-    event.af = BPF_CORE_READ(sk, __sk_common.skc_family);
-    if (event.af == AF_INET) {
-        event.saddr_v4 = BPF_CORE_READ(sk, __sk_common.skc_rcv_saddr);
-        event.daddr_v4 = BPF_CORE_READ(sk, __sk_common.skc_daddr);
+    event->delta_us = delta / 1000U;
+    __builtin_memcpy(&event->comm, piddatap->comm, sizeof(event->comm));
+    event->ts_us = ts / 1000;
+    event->tgid = piddatap->tgid;
+    event->lport = BPF_CORE_READ(sk, __sk_common.skc_num);
+    event->dport = BPF_CORE_READ(sk, __sk_common.skc_dport);
+    event->af = BPF_CORE_READ(sk, __sk_common.skc_family);
+    if (event->af == AF_INET) {
+        event->saddr_v4 = BPF_CORE_READ(sk, __sk_common.skc_rcv_saddr);
+        event->daddr_v4 = BPF_CORE_READ(sk, __sk_common.skc_daddr);
     } else {
-        BPF_CORE_READ_INTO(&event.saddr_v6, sk,
+        BPF_CORE_READ_INTO(&event->saddr_v6, sk,
                            __sk_common.skc_v6_rcv_saddr.in6_u.u6_addr32);
-        BPF_CORE_READ_INTO(&event.daddr_v6, sk,
+        BPF_CORE_READ_INTO(&event->daddr_v6, sk,
                            __sk_common.skc_v6_daddr.in6_u.u6_addr32);
     }
-    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, &event,
-                          sizeof(event));
+    submit_buf(ctx, event, sizeof(*event));
 
 cleanup:
     bpf_map_delete_elem(&start, &sk);
@@ -0,0 +1,15 @@
+"""Helpers shared by the run.py scripts of the benchmarks.
+
+Add the repository root to sys.path and import from here:
+
+    sys.path.insert(0, str(pathlib.Path(__file__).parent.parent))
+    from harness import generate_statistics, repeat, pin_runtime
+"""
+from .stats import generate_statistics, percentile, bootstrap_ci
+from .system import (repeat, warmup_runs, pin_runtime, pin_producer,
+                     producer_first_cpu, cpu_governors, check_governor,
+                     environment, read_smaps_rollup, read_memlock)
+from .history import record as record_history
+from .pmu import parse_pmu_lines, perf_stat, differential, with_ipc
+from .flamegraph import diff as flamegraph_diff
+from .bpftime import bpftime_load, bpftime_start
@@ -0,0 +1,192 @@
+"""Binary event logs of the examples.
+
+bootstrap, execve and opensnoop append the raw records of their ring buffer
+to a file with --binary-out FILE instead of formatting them. The file starts
+with a header carrying the layout of the event struct, taken from the BTF of
+the bpf object at build time:
+
+    python3 -m harness.binlog schema opensnoop.bpf.o event > opensnoop.schema.h
+
+and decode turns the records back into text or CSV when they are needed:
+
+    python3 -m harness.binlog decode opensnoop.log
+    python3 -m harness.binlog decode --csv --fields pid,comm,fname opensnoop.log
+
+Layout, see binlog_open() in examples/common/output.h: MAGIC, 0x01020304 as
+a u32 in the byte order of the writer, the length of the schema as a u32, the
+schema as JSON, then every record after its length as a u32. Records can be
+shorter than the struct: the examples stop after the NUL of their last,
+variable length string, so fields past the end of a record are empty.
+"""
+import argparse
+import csv
+import json
+import os
+import struct
+import subprocess
+import sys
+from typing import BinaryIO, Dict, Iterator, List, Tuple
+
+MAGIC = b"BPFBLOG1"
+BYTE_ORDER_MARK = 0x01020304
+# BTF kinds that only qualify or rename another type
+QUALIFIERS = {"TYPEDEF", "VOLATILE", "CONST", "RESTRICT", "TYPE_TAG"}
+INT_FORMATS = {1: "b", 2: "h", 4: "i", 8: "q"}
+FLOAT_FORMATS = {4: "f", 8: "d"}
+
+
+def btf_types(obj: str, bpftool: str) -> Dict[int, dict]:
+    out = subprocess.check_output([bpftool, "btf", "dump", "file", obj, "format", "raw", "-j"])
+    return {t["id"]: t for t in json.loads(out)["types"]}
+
+
+def resolve(types: Dict[int, dict], type_id: int) -> dict:
+    t = types[type_id]
+    while t["kind"] in QUALIFIERS:
+        t = types[t["type_id"]]
+    return t
+
+
+def type_size(types: Dict[int, dict], t: dict) -> int:
+    if t["kind"] == "ARRAY":
+        return t["nr_elems"] * type_size(types, resolve(types, t["type_id"]))
+    if t["kind"] == "PTR":
+        return 8
+    return t["size"]
+
+
+def is_char(t: dict) -> bool:
+    return t["kind"] == "INT" and t["size"] == 1
+
+
+def field(types: Dict[int, dict], member: dict) -> dict:
+    if member.get("bitfield_size"):
+        raise ValueError(f"{member['name']}: bitfields are not supported")
+    if member["bits_offset"] % 8:
+        raise ValueError(f"{member['name']}: not byte aligned")
+    t = resolve(types, member["type_id"])
+    result = {"name": member["name"], "offset": member["bits_offset"] // 8, "size": type_size(types, t)}
+    if t["kind"] == "INT":
+        encoding = t.get("encoding", "(none)")
+        result["type"] = "bool" if encoding == "BOOL" else "int" if encoding in ("SIGNED", "CHAR") else "uint"
+    elif t["kind"] in ("ENUM", "ENUM64"):
+        result["type"] = "int"
+    elif t["kind"] == "PTR":
+        result["type"] = "uint"
+    elif t["kind"] == "FLOAT":
+        result["type"] = "float"
+    elif t["kind"] == "ARRAY" and is_char(resolve(types, t["type_id"])):
+        result["type"] = "string"
+    else:
+        # nested structs, unions and other arrays as hex
+        result["type"] = "bytes"
+    return result
+
+
+def schema(obj: str, name: str, bpftool: str = "bpftool") -> dict:
+    """Layout of struct *name* in the BTF of the bpf object *obj*"""
+    types = btf_types(obj, bpftool)
+    for t in types.values():
+        if t["kind"] == "STRUCT" and t["name"] == name:
+            return {"struct": name, "size": t["size"], "fields": [field(types, m) for m in t["members"]]}
+    raise KeyError(f"no struct {name} in the BTF of {obj}")
+
+
+def schema_header(layout: dict, obj: str) -> str:
+    """C header with the schema as the string <struct>_schema"""
+    text = json.dumps(layout, separators=(",", ":")).replace("\\", "\\\\").replace('"', '\\"')
+    guard = f"__{layout['struct'].upper()}_SCHEMA_H"
+    return (f"/* generated by harness/binlog.py from {os.path.basename(obj)}, do not edit */\n"
+            f"#ifndef {guard}\n"
+            f"#define {guard}\n\n"
+            f"static const char {layout['struct']}_schema[] =\n"
+            f"    \"{text}\";\n\n"
+            f"#endif /* {guard} */\n")
+
+
+def read_header(f: BinaryIO) -> Tuple[str, dict]:
+    """Byte order for struct and the schema of the log"""
+    if f.read(len(MAGIC)) != MAGIC:
+        raise ValueError("not a binary event log")
+    head = f.read(8)
+    for order in ("<", ">"):
+        bom, length = struct.unpack(order + "II", head)
+        if bom == BYTE_ORDER_MARK:
+            return order, json.loads(f.read(length))
+    raise ValueError("bad byte order mark")
+
+
+def records(f: BinaryIO, order: str) -> Iterator[bytes]:
+    while True:
+        head = f.read(4)
+        if not head:
+            return
+        if len(head) == 4:
+            length, = struct.unpack(order + "I", head)
+            record = f.read(length)
+            if len(record) == length:
+                yield record
+                continue
+        # the writer died in the middle of a record
+        print("truncated record at the end of the log", file=sys.stderr)
+        return
+
+
+def decode_field(record: bytes, column: dict, order: str) -> str:
+    value = record[column["offset"]:column["offset"] + column["size"]]
+    if column["type"] == "string":
+        return value.split(b"\0", 1)[0].decode(errors="replace")
+    if len(value) < column["size"]:
+        # past the end of a short record
+        return ""
+    if column["type"] in ("int", "uint", "bool") and column["size"] in INT_FORMATS:
+        fmt = INT_FORMATS[column["size"]]
+        return str(struct.unpack(order + (fmt if column["type"] == "int" else fmt.upper()), value)[0])
+    if column["type"] == "float" and column["size"] in FLOAT_FORMATS:
+        return str(struct.unpack(order + FLOAT_FORMATS[column["size"]], value)[0])
+    return value.hex()
+
+
+def decode(log: str, as_csv: bool = False, names: List[str] = None, out=sys.stdout):
+    with open(log, "rb") as f:
+        order, layout = read_header(f)
+        columns = layout["fields"]
+        if names:
+            by_name = {column["name"]: column for column in columns}
+            columns = [by_name[name] for name in names]
+        writer = csv.writer(out) if as_csv else None
+        if writer:
+            writer.writerow([column["name"] for column in columns])
+        for record in records(f, order):
+            values = [decode_field(record, column, order) for column in columns]
+            if writer:
+                writer.writerow(values)
+            else:
+                # quote what would not read back as one word
+                out.write(" ".join(f"{column['name']}={json.dumps(value) if not value or ' ' in value else value}"
+                                   for column, value in zip(columns, values)) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="binary event logs of the examples")
+    sub = parser.add_subparsers(dest="command", required=True)
+    gen = sub.add_parser("schema", help="C header with the layout of a struct, from the BTF of a bpf object")
+    gen.add_argument("obj")
+    gen.add_argument("struct")
+    gen.add_argument("--bpftool", default=os.environ.get("BPFTOOL", "bpftool"))
+    dec = sub.add_parser("decode", help="print the records of a log as text or CSV")
+    dec.add_argument("log")
+    dec.add_argument("--csv", action="store_true")
+    dec.add_argument("--fields", help="comma separated fields to print, all by default")
+    args = parser.parse_args()
+    if args.command == "schema":
+        sys.stdout.write(schema_header(schema(args.obj, args.struct, args.bpftool), args.obj))
+    else:
+        try:
+            decode(args.log, args.csv, args.fields.split(",") if args.fields else None)
+        except BrokenPipeError:
+            pass
+
+
+if __name__ == "__main__":
+    main()
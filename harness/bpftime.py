@@ -0,0 +1,26 @@
+"""Run the native benchmark binaries under bpftime, the userspace eBPF
+runtime.
+
+`bpftime load` starts a process with the syscall server preloaded: the bpf()
+calls of the unmodified native binary create the maps and ring buffers in
+shared memory instead of the kernel, so map operations never leave user
+space. `bpftime start` starts a process with the agent preloaded, which reads
+the programs from that shared memory and patches the probed functions, so a
+uprobe hit is a call instead of a trap. The loader has to be up before the
+agent starts.
+
+BPFTIME is the bpftime cli, `bpftime` in PATH by default; it looks for its
+libraries in ~/.bpftime.
+"""
+import os
+from typing import List
+
+BPFTIME = os.environ.get("BPFTIME", "bpftime")
+
+
+def bpftime_load(cmdline: List[str]) -> List[str]:
+    return [BPFTIME, "load", *[str(x) for x in cmdline]]
+
+
+def bpftime_start(cmdline: List[str]) -> List[str]:
+    return [BPFTIME, "start", *[str(x) for x in cmdline]]
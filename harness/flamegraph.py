@@ -0,0 +1,154 @@
+"""Differential flame graph of the native and wasm runs.
+
+run.py keeps the `perf script` output of every run under result/
+(native0.perf, wasm0.perf, ...). This merges the stacks of all runs of each
+kind, draws the wasm stacks colored by how they differ from native, and
+prints how much of the extra wasm time falls into each bucket:
+
+    python3 -m harness.flamegraph maps_benchmark/result
+
+The sample counts are only comparable for the same amount of work. The
+maps runs do a fixed number of lookups, so they are divided by the number of
+runs. The ringbuf runs last a fixed time and handle however many events
+arrive, so run.py writes the events of each run next to its profile
+(native0.perf.events, ...); when every profile has one, the samples are
+divided by the events instead and reported per million events.
+"""
+import argparse
+import os
+import pathlib
+import re
+import subprocess
+from typing import Dict, List, Tuple, Union
+
+FLAME_GRAPH_ROOT = pathlib.Path(os.environ.get("FLAME_GRAPH_ROOT", "/root/FlameGraph"))
+
+# checked in order against the frames of a stack, root first, leaf last
+BUCKETS: List[Tuple[str, str, re.Pattern]] = [
+    # anything that entered the kernel
+    ("syscalls", "any", re.compile(r"entry_SYSCALL|do_syscall_64|__x64_sys_|__arm64_sys_|el0_svc")),
+    # copies between the linear memory and the host, with their bounds checks
+    ("memory copies", "leaf", re.compile(
+        r"memcpy|memmove|memset|bh_memcpy|validate_app_addr|validate_native_addr|addr_app_to_native")),
+    # calling from the guest into host functions and back
+    ("runtime dispatch", "any", re.compile(
+        r"wasm_runtime_invoke_native|invoke_native|wasm_native_|aot_invoke_native|wasm_bpf_")),
+    # compiled guest code, perf can not name it
+    ("guest code", "leaf", re.compile(r"aot_func|wasm_func|jit|\[unknown\]")),
+]
+OTHER = "other"
+
+
+def collapse(perf_script: pathlib.Path) -> Dict[str, int]:
+    out = subprocess.check_output(
+        f"{FLAME_GRAPH_ROOT/'stackcollapse-perf.pl'} < {perf_script}", shell=True, text=True)
+    return parse_folded(out)
+
+
+def parse_folded(text: str) -> Dict[str, int]:
+    stacks: Dict[str, int] = {}
+    for line in text.splitlines():
+        stack, _, count = line.rpartition(" ")
+        if stack:
+            stacks[stack] = stacks.get(stack, 0) + int(count)
+    return stacks
+
+
+# unit of the samples when they are normalized by events
+EVENTS_UNIT = 1e6
+
+
+def read_events(perf_script: pathlib.Path) -> Union[float, None]:
+    """Events handled by the run of a profile, if run.py wrote them"""
+    path = perf_script.with_name(perf_script.name + ".events")
+    if not path.exists():
+        return None
+    with open(path) as f:
+        return float(f.read())
+
+
+def merge(runs: List[Dict[str, int]], events: Union[List[float], None] = None) -> Dict[str, float]:
+    """Average samples per run of every stack, or per EVENTS_UNIT events if
+    the events of every run are given"""
+    total = sum(events) / EVENTS_UNIT if events else len(runs)
+    merged: Dict[str, float] = {}
+    for stacks in runs:
+        for stack, count in stacks.items():
+            merged[stack] = merged.get(stack, 0) + count / total
+    return merged
+
+
+def write_folded(stacks: Dict[str, float], path: pathlib.Path):
+    with open(path, "w") as f:
+        for stack, count in sorted(stacks.items()):
+            f.write(f"{stack} {round(count)}\n")
+
+
+def bucket(stack: str) -> str:
+    frames = stack.split(";")
+    for name, where, pattern in BUCKETS:
+        if where == "leaf" and pattern.search(frames[-1]):
+            return name
+        if where == "any" and any(pattern.search(frame) for frame in frames):
+            return name
+    return OTHER
+
+
+def attribute(stacks: Dict[str, float]) -> Dict[str, float]:
+    result = {name: 0.0 for name, _, _ in BUCKETS}
+    result[OTHER] = 0.0
+    for stack, count in stacks.items():
+        result[bucket(stack)] += count
+    return result
+
+
+def print_table(native: Dict[str, float], wasm: Dict[str, float], unit: str):
+    excess = {name: wasm[name] - native[name] for name in wasm}
+    total_excess = sum(excess.values())
+    print(f"{'bucket':<18} {'native':>10} {'wasm':>10} {'excess':>10} {'share':>7}")
+    for name in wasm:
+        share = excess[name] / total_excess * 100 if total_excess else 0
+        print(f"{name:<18} {native[name]:>10.0f} {wasm[name]:>10.0f} {excess[name]:>10.0f} {share:>6.1f}%")
+    print(f"{'total':<18} {sum(native.values()):>10.0f} {sum(wasm.values()):>10.0f} {total_excess:>10.0f}")
+    print(f"(samples per {unit})")
+
+
+def diff(result_dir: pathlib.Path, native_glob: str = "native*.perf", wasm_glob: str = "wasm*.perf"):
+    """Writes native.folded, wasm.folded and diff.svg to result_dir and
+    returns the buckets of both, with the unit of their samples"""
+    native_paths = sorted(result_dir.glob(native_glob))
+    wasm_paths = sorted(result_dir.glob(wasm_glob))
+    if not native_paths or not wasm_paths:
+        raise FileNotFoundError(f"no {native_glob} or {wasm_glob} in {result_dir}")
+    native_runs = [collapse(p) for p in native_paths]
+    wasm_runs = [collapse(p) for p in wasm_paths]
+    native_events = [read_events(p) for p in native_paths]
+    wasm_events = [read_events(p) for p in wasm_paths]
+    if None in native_events or None in wasm_events:
+        native, wasm = merge(native_runs), merge(wasm_runs)
+        unit = "run"
+    else:
+        native, wasm = merge(native_runs, native_events), merge(wasm_runs, wasm_events)
+        unit = "million events"
+    write_folded(native, result_dir/"native.folded")
+    write_folded(wasm, result_dir/"wasm.folded")
+    # red frames take longer in wasm, blue ones shorter; the frame widths are
+    # the wasm samples
+    os.system(f"{FLAME_GRAPH_ROOT/'difffolded.pl'} {result_dir/'native.folded'} {result_dir/'wasm.folded'} | "
+              f"{FLAME_GRAPH_ROOT/'flamegraph.pl'} --title 'wasm vs native' > {result_dir/'diff.svg'}")
+    native_buckets, wasm_buckets = attribute(native), attribute(wasm)
+    print_table(native_buckets, wasm_buckets, unit)
+    return {"native": native_buckets, "wasm": wasm_buckets, "unit": unit}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="differential flame graph of native and wasm runs")
+    parser.add_argument("result_dir", type=pathlib.Path)
+    parser.add_argument("--native", default="native*.perf", help="perf script outputs of the native runs")
+    parser.add_argument("--wasm", default="wasm*.perf", help="perf script outputs of the wasm runs")
+    args = parser.parse_args()
+    diff(args.result_dir, args.native, args.wasm)
+
+
+if __name__ == "__main__":
+    main()
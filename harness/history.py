@@ -0,0 +1,257 @@
+"""Result history and regression check.
+
+Every result a run.py writes is also appended to history.jsonl at the
+repository root, keyed by the commit of this tree, a hash of the wasm-bpf
+runtime binary and the kernel release. compare picks a baseline entry and a
+candidate entry of the same result file and runs a Mann-Whitney U test on
+the raw samples of every metric that says which direction is better:
+
+    python3 -m harness.history list
+    python3 -m harness.history compare --baseline-runtime 1a2b3c4d5e6f
+
+It exits with 1 if any metric got significantly worse, so it can gate a
+runtime upgrade.
+"""
+import argparse
+import datetime
+import hashlib
+import json
+import math
+import pathlib
+import platform
+import subprocess
+import sys
+from typing import Dict, Iterator, List, Tuple, Union
+
+PROJECT_ROOT = pathlib.Path(__file__).parent.parent
+HISTORY_FILE = PROJECT_ROOT/"history.jsonl"
+WASM_BPF = PROJECT_ROOT/"assets"/"wasm-bpf"
+
+
+def tree_commit() -> str:
+    try:
+        commit = subprocess.check_output(
+            ["git", "rev-parse", "--short=12", "HEAD"], cwd=PROJECT_ROOT, text=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+    dirty = subprocess.run(["git", "diff", "--quiet", "HEAD"], cwd=PROJECT_ROOT).returncode
+    return commit + ("-dirty" if dirty else "")
+
+
+def runtime_version() -> str:
+    """The runtime does not report a version, so identify it by its hash"""
+    try:
+        with open(WASM_BPF, "rb") as f:
+            return hashlib.sha256(f.read()).hexdigest()[:12]
+    except OSError:
+        return "missing"
+
+
+def record(benchmark: str, name: str, result: dict):
+    """Append the result of benchmark (the directory) written to name"""
+    entry = {
+        "benchmark": benchmark,
+        "name": name,
+        "commit": tree_commit(),
+        "runtime": runtime_version(),
+        "kernel": platform.release(),
+        "time": datetime.datetime.now().isoformat(timespec="seconds"),
+        "result": result,
+    }
+    with open(HISTORY_FILE, "a") as f:
+        f.write(json.dumps(entry) + "\n")
+
+
+def load() -> List[dict]:
+    if not HISTORY_FILE.exists():
+        return []
+    with open(HISTORY_FILE) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+def metrics(result: dict, prefix: str = "") -> Iterator[Tuple[str, dict]]:
+    """The statistics with a direction, by their path in the result"""
+    for key, value in result.items():
+        if not isinstance(value, dict):
+            continue
+        path = f"{prefix}/{key}" if prefix else str(key)
+        if "raw_data" in value:
+            if value.get("better") in ("lower", "higher"):
+                yield path, value
+        else:
+            yield from metrics(value, path)
+
+
+# up to this many samples in both series together the p-value is exact
+EXACT_MAX_SAMPLES = 40
+
+
+def midranks(a: List[float], b: List[float]) -> Tuple[List[float], float, float]:
+    """Ranks of all samples, ties sharing the mean rank, the rank sum of a
+    and the tie term sum(t^3 - t)"""
+    values = sorted([(x, 0) for x in a] + [(x, 1) for x in b])
+    ranks = [0.0] * len(values)
+    ties = 0.0
+    i = 0
+    while i < len(values):
+        j = i
+        while j + 1 < len(values) and values[j + 1][0] == values[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2 + 1
+        t = j - i + 1
+        ties += t**3 - t
+        i = j + 1
+    r1 = sum(r for r, (_, group) in zip(ranks, values) if group == 0)
+    return ranks, r1, ties
+
+
+def rank_sum_counts(ranks: List[float], n1: int) -> Dict[int, int]:
+    """How many ways n1 of the ranks can be picked, by twice their sum (the
+    midranks of ties are halves)"""
+    counts: List[Dict[int, int]] = [{} for _ in range(n1 + 1)]
+    counts[0][0] = 1
+    for r in ranks:
+        r2 = round(2 * r)
+        for k in range(n1, 0, -1):
+            for total, ways in counts[k - 1].items():
+                counts[k][total + r2] = counts[k].get(total + r2, 0) + ways
+    return counts[n1]
+
+
+def exact_p(counts: Dict[int, int], deviation2: float) -> float:
+    """Share of the rank sums at least deviation2 away from the mean, both
+    doubled"""
+    mean2 = sum(total * ways for total, ways in counts.items()) / sum(counts.values())
+    extreme = sum(ways for total, ways in counts.items() if abs(total - mean2) >= deviation2 - 1e-9)
+    return extreme / sum(counts.values())
+
+
+def mann_whitney(a: List[float], b: List[float]) -> float:
+    """Two sided p-value of the Mann-Whitney U test: exact from the
+    permutation distribution of the rank sum (ties included) up to
+    EXACT_MAX_SAMPLES samples, the normal approximation with tie correction
+    above"""
+    n1, n2 = len(a), len(b)
+    n = n1 + n2
+    ranks, r1, ties = midranks(a, b)
+    if n <= EXACT_MAX_SAMPLES:
+        return exact_p(rank_sum_counts(ranks, n1), abs(2 * r1 - n1 * (n + 1)))
+    u = r1 - n1 * (n1 + 1) / 2
+    sigma = math.sqrt(n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1))))
+    if sigma == 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2) - 0.5) / sigma
+    return math.erfc(max(z, 0) / math.sqrt(2))
+
+
+def min_p(a: List[float], b: List[float]) -> float:
+    """Smallest p-value mann_whitney can return for series of these sizes
+    and ties, reached when they do not overlap at all"""
+    lowest, highest = sorted(a + b)[:len(a)], sorted(a + b)[len(a):]
+    return mann_whitney(lowest, highest)
+
+
+def median(data: List[float]) -> float:
+    values = sorted(data)
+    mid = len(values) // 2
+    return values[mid] if len(values) % 2 else (values[mid - 1] + values[mid]) / 2
+
+
+Change = Tuple[str, float, float, float]
+
+
+def compare_results(baseline: dict, candidate: dict, alpha: float,
+                    threshold: float) -> Tuple[List[Change], List[Change]]:
+    """Metrics whose median moved in the worse direction by more than
+    threshold (relative) with p < alpha, and those that moved as far but
+    have too few samples for any p to get below alpha, each as
+    (path, baseline, candidate, p)"""
+    base = dict(metrics(baseline))
+    regressions = []
+    insufficient = []
+    for path, stats in metrics(candidate):
+        if path not in base or len(stats["raw_data"]) < 2 or len(base[path]["raw_data"]) < 2:
+            continue
+        old, new = median(base[path]["raw_data"]), median(stats["raw_data"])
+        change = (new - old) / abs(old) if old else 0.0
+        worse = change > threshold if stats["better"] == "lower" else change < -threshold
+        if not worse:
+            continue
+        smallest = min_p(base[path]["raw_data"], stats["raw_data"])
+        if smallest >= alpha:
+            insufficient.append((path, old, new, smallest))
+            continue
+        p = mann_whitney(base[path]["raw_data"], stats["raw_data"])
+        if p < alpha:
+            regressions.append((path, old, new, p))
+    return regressions, insufficient
+
+
+def matches(entry: dict, commit: Union[str, None], runtime: Union[str, None]) -> bool:
+    return ((not commit or entry["commit"].startswith(commit)) and
+            (not runtime or entry["runtime"].startswith(runtime)))
+
+
+def compare(args) -> int:
+    entries = load()
+    regressed = False
+    keys = sorted({(e["benchmark"], e["name"]) for e in entries})
+    for benchmark, name in keys:
+        if args.benchmark and benchmark != args.benchmark:
+            continue
+        group = [e for e in entries if (e["benchmark"], e["name"]) == (benchmark, name)]
+        candidates = [e for e in group if matches(e, args.candidate_commit, args.candidate_runtime)]
+        if not candidates:
+            continue
+        candidate = candidates[-1]
+        older = group[:group.index(candidate)]
+        baselines = [e for e in older if
+                     matches(e, args.baseline_commit, args.baseline_runtime) and
+                     (args.any_kernel or e["kernel"] == candidate["kernel"])]
+        if not baselines:
+            print(f"{benchmark}/{name}: no baseline")
+            continue
+        baseline = baselines[-1]
+        print(f"{benchmark}/{name}: {baseline['commit']} runtime {baseline['runtime']} -> "
+              f"{candidate['commit']} runtime {candidate['runtime']} on {candidate['kernel']}")
+        regressions, insufficient = compare_results(
+            baseline["result"], candidate["result"], args.alpha, args.threshold)
+        for path, old, new, p in regressions:
+            regressed = True
+            print(f"  REGRESSION {path}: median {old:.6g} -> {new:.6g} (p={p:.3g})")
+        for path, old, new, p in insufficient:
+            regressed = True
+            print(f"  INSUFFICIENT SAMPLES {path}: median {old:.6g} -> {new:.6g}, "
+                  f"p can not get below {p:.3g}")
+    return 1 if regressed else 0
+
+
+def list_entries(args) -> int:
+    for e in load():
+        print(f"{e['time']} {e['benchmark']}/{e['name']} commit {e['commit']} "
+              f"runtime {e['runtime']} kernel {e['kernel']}")
+    return 0
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="benchmark result history")
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("list")
+    cmp = sub.add_parser("compare", help="exit with 1 on significant regressions")
+    cmp.add_argument("--baseline-commit")
+    cmp.add_argument("--baseline-runtime")
+    cmp.add_argument("--candidate-commit", help="default: the latest entry")
+    cmp.add_argument("--candidate-runtime", help="default: the latest entry")
+    cmp.add_argument("--benchmark", help="e.g. maps_benchmark")
+    cmp.add_argument("--alpha", type=float, default=0.01)
+    cmp.add_argument("--threshold", type=float, default=0.02,
+                     help="relative change of the median to ignore")
+    cmp.add_argument("--any-kernel", action="store_true",
+                     help="also compare results from different kernels")
+    args = parser.parse_args()
+    return compare(args) if args.command == "compare" else list_entries(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,59 @@
+import os
+import subprocess
+import tempfile
+from typing import Dict, List, Tuple
+
+# the run.py scripts record their flame graphs with this perf as well
+PERF = os.environ.get("PERF", "perf_6.2")
+# same events as benchmark_common/pmu_counters.h
+PMU_EVENTS = ["instructions", "cycles", "cache-misses", "branch-misses",
+              "context-switches", "page-faults", "task-clock"]
+
+
+def parse_pmu_lines(lines: List[str]) -> Dict[str, float]:
+    """Per op values from the "pmu <event> <total> <per op>" lines that
+    pmu_counters.h prints; events that could not be opened are left out"""
+    result = {}
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 4 and fields[0] == "pmu":
+            result[fields[1]] = float(fields[3])
+    return result
+
+
+def perf_stat(cmdline: List[str]) -> Tuple[Dict[str, float], List[str]]:
+    """Run cmdline under perf stat and return the event totals and the lines
+    it printed, for the wasm builds which can not open counters from inside
+    the guest"""
+    with tempfile.NamedTemporaryFile("r", suffix=".perf_stat") as out:
+        proc = subprocess.run([PERF, "stat", "-x", ",", "-o", out.name, "-e", ",".join(PMU_EVENTS),
+                               "--", *[str(x) for x in cmdline]], text=True, stdout=subprocess.PIPE,
+                              stderr=subprocess.PIPE)
+        result = {}
+        for line in out:
+            fields = line.strip().split(",")
+            if len(fields) < 3 or line.startswith("#"):
+                continue
+            try:
+                value = float(fields[0])
+            except ValueError:
+                # <not supported> or <not counted>
+                continue
+            if fields[1] == "msec":
+                # task-clock, pmu_counters.h reports it in ns
+                value *= 1e6
+            result[fields[2].split(":")[0]] = value
+        return result, proc.stdout.splitlines()
+
+
+def differential(full: Dict[str, float], base: Dict[str, float], ops: float) -> Dict[str, float]:
+    """Per op cost of the measured loop: a run doing ops operations minus a
+    run doing none, which leaves out runtime startup and program loading"""
+    ops = ops or 1
+    return {event: (full[event] - base.get(event, 0)) / ops for event in full}
+
+
+def with_ipc(per_op: Dict[str, float]) -> Dict[str, float]:
+    if per_op.get("cycles"):
+        return {**per_op, "ipc": per_op.get("instructions", 0) / per_op["cycles"]}
+    return per_op
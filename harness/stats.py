@@ -0,0 +1,60 @@
+import math
+import random
+from typing import List, Tuple, Union
+
+BOOTSTRAP_RESAMPLES = 1000
+# fixed so the same samples always give the same interval
+BOOTSTRAP_SEED = 0x5eed
+
+
+def percentile(data: List[float], pct: float) -> float:
+    """Linear interpolation between the closest ranks, like numpy's default"""
+    values = sorted(data)
+    if len(values) == 1:
+        return values[0]
+    rank = pct / 100 * (len(values) - 1)
+    low = math.floor(rank)
+    high = min(low + 1, len(values) - 1)
+    return values[low] + (values[high] - values[low]) * (rank - low)
+
+
+def bootstrap_ci(data: List[float], confidence: float = 0.95) -> Tuple[float, float]:
+    """Percentile bootstrap confidence interval of the mean"""
+    rng = random.Random(BOOTSTRAP_SEED)
+    n = len(data)
+    means = sorted(sum(rng.choice(data) for _ in range(n)) / n
+                   for _ in range(BOOTSTRAP_RESAMPLES))
+    tail = (1 - confidence) / 2 * 100
+    return percentile(means, tail), percentile(means, 100 - tail)
+
+
+def outliers(data: List[float]) -> List[float]:
+    """Samples outside the Tukey fences, 1.5 IQR beyond the quartiles"""
+    q1, q3 = percentile(data, 25), percentile(data, 75)
+    fence = 1.5 * (q3 - q1)
+    return [x for x in data if x < q1 - fence or x > q3 + fence]
+
+
+def generate_statistics(data: List[float], better: Union[str, None] = None):
+    """better is "lower" or "higher" and tells the history compare which way
+    a change is a regression"""
+    sqrsum = sum(x**2 for x in data)
+    avg = sum(data)/len(data)
+    sqr = sqrsum/len(data) - avg**2
+    ci_low, ci_high = bootstrap_ci(data)
+    result = {
+        "max": max(data),
+        "min": min(data),
+        "sqr": sqr,
+        "avg": avg,
+        "p50": percentile(data, 50),
+        "p90": percentile(data, 90),
+        "p99": percentile(data, 99),
+        "ci95": [ci_low, ci_high],
+        "outliers": len(outliers(data)),
+        "count": len(data),
+        "raw_data": data
+    }
+    if better:
+        result["better"] = better
+    return result
@@ -0,0 +1,112 @@
+import glob
+import os
+import platform
+from typing import Callable, Dict, List, TypeVar, Union
+
+T = TypeVar("T")
+
+# The knobs are environment variables so every run.py picks them up without
+# growing its own command line:
+#   HARNESS_WARMUP         runs to do and throw away before measuring (1)
+#   HARNESS_RUNTIME_CPUS   cpu list for the benchmark process or container
+#   HARNESS_PRODUCER_CPUS  cpu list for event producers, e.g. ringbuf's target
+
+
+def warmup_runs() -> int:
+    return int(os.environ.get("HARNESS_WARMUP", "1"))
+
+
+def repeat(fn: Callable[[int], T], count: int, warmup: Union[int, None] = None) -> List[T]:
+    """Call fn(i) warmup times and throw the results away, then count times
+    and return the results"""
+    for _ in range(warmup_runs() if warmup is None else warmup):
+        fn(-1)
+    return [fn(i) for i in range(count)]
+
+
+def pin_runtime(cmdline: List[str]) -> List[str]:
+    """Restrict cmdline to HARNESS_RUNTIME_CPUS: taskset for a process,
+    --cpuset-cpus for docker run since the container is not our child"""
+    cpus = os.environ.get("HARNESS_RUNTIME_CPUS")
+    if not cpus:
+        return list(cmdline)
+    cmdline = [str(x) for x in cmdline]
+    if cmdline[:2] == ["docker", "run"]:
+        return ["docker", "run", "--cpuset-cpus", cpus, *cmdline[2:]]
+    return ["taskset", "-c", cpus, *cmdline]
+
+
+def pin_producer(cmdline: List[str]) -> List[str]:
+    cpus = os.environ.get("HARNESS_PRODUCER_CPUS")
+    if not cpus:
+        return list(cmdline)
+    return ["taskset", "-c", cpus, *[str(x) for x in cmdline]]
+
+
+def producer_first_cpu() -> Union[int, None]:
+    """First cpu of HARNESS_PRODUCER_CPUS, for producers that pin their
+    threads themselves"""
+    cpus = os.environ.get("HARNESS_PRODUCER_CPUS")
+    if not cpus:
+        return None
+    return int(cpus.split(",")[0].split("-")[0])
+
+
+def cpu_governors() -> Dict[str, int]:
+    """How many cpus run each cpufreq governor, empty without cpufreq"""
+    result: Dict[str, int] = {}
+    for path in glob.glob("/sys/devices/system/cpu/cpu*/cpufreq/scaling_governor"):
+        with open(path) as f:
+            governor = f.read().strip()
+        result[governor] = result.get(governor, 0) + 1
+    return result
+
+
+def check_governor():
+    governors = cpu_governors()
+    if governors and set(governors) != {"performance"}:
+        print(f"warning: cpufreq governors {governors}, numbers will be noisy; "
+              "use `cpupower frequency-set -g performance`")
+
+
+def environment() -> Dict[str, object]:
+    """What the numbers were measured on, stored next to the results"""
+    check_governor()
+    return {
+        "kernel": platform.release(),
+        "cpu_count": os.cpu_count(),
+        "governors": cpu_governors(),
+        "warmup": warmup_runs(),
+        "runtime_cpus": os.environ.get("HARNESS_RUNTIME_CPUS"),
+        "producer_cpus": os.environ.get("HARNESS_PRODUCER_CPUS"),
+    }
+
+
+def read_smaps_rollup(pid: int) -> Dict[str, int]:
+    """Rss and Pss of a process in bytes"""
+    result = {}
+    with open(f"/proc/{pid}/smaps_rollup") as f:
+        for line in f:
+            fields = line.split()
+            if fields[0] in ("Rss:", "Pss:"):
+                result[fields[0][:-1].lower()] = int(fields[1]) * 1024
+    return result
+
+
+def read_memlock(pid: int) -> Dict[str, int]:
+    """Kernel memory charged to the bpf maps and programs the process holds
+    open, from the memlock field of their fdinfo"""
+    result = {"map_memlock": 0, "prog_memlock": 0}
+    for fd in os.listdir(f"/proc/{pid}/fdinfo"):
+        try:
+            with open(f"/proc/{pid}/fdinfo/{fd}") as f:
+                info = dict(line.split(":", 1) for line in f if ":" in line)
+        except OSError:
+            continue
+        if "memlock" not in info:
+            continue
+        if "map_type" in info:
+            result["map_memlock"] += int(info["memlock"])
+        elif "prog_type" in info:
+            result["prog_memlock"] += int(info["memlock"])
+    return result
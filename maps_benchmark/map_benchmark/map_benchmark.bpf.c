@@ -11,6 +11,15 @@ struct {
   __type(key, long);
   __type(value, long);
 } test_map SEC(".maps");
+
+/* same layout as test_map, used to measure the LRU list locks */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 8192);
+  __type(key, long);
+  __type(value, long);
+} test_lru_map SEC(".maps");
+
 SEC("tp/syscalls/sys_enter_execve")
 int sys_enter_execve(void *ctx) {
     return 0;
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #ifdef NATIVE_LIBBPF
@@ -14,21 +15,335 @@
 #else
 #include "libbpf-wasm.h"
 #endif
+#include "cycle_clock.h"
+#include "latency_hist.h"
 #include "map_benchmark.skel.h"
+#include "pmu_counters.h"
+
+/* native builds always have pthreads; the wasm build only gets them when
+ * compiled for wasm32-wasi-threads (see the threads target in Makefile) */
+#if defined(NATIVE_LIBBPF) && !defined(MAP_BENCH_THREADS)
+#define MAP_BENCH_THREADS
+#endif
+#ifdef MAP_BENCH_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #define NANO_SECOND_TO_TEST ((uint64_t)1000 * 1000 * 1000 * 3)
 
 #define TEST_COUNT 1000000
 
+/* must match max_entries of the maps in map_benchmark.bpf.c */
+#define MAX_KEYS 8192
+#define MAX_THREADS 256
+
+static struct env {
+  int threads;
+  int read_pct;
+  bool disjoint;
+  bool lru;
+  uint64_t ops;
+  int keys;
+  bool counters;
+  bool latency;
+} env = {
+    .threads = 0,
+    .read_pct = 100,
+    .ops = TEST_COUNT,
+    .keys = 100,
+};
+
+const char argp_program_doc[] =
+    "Measure the bpf map syscall speed.\n"
+    "\n"
+    "USAGE: map_benchmark [-t THREADS] [-r READ_PCT] [-k shared|disjoint]\n"
+    "                     [-m hash|lru] [-n OPS] [-K KEYS] [-C] [-L]\n"
+    "\n"
+    "Without -t a single thread looks up one key OPS times.\n"
+    "With -t, THREADS workers pinned to distinct CPUs run a mix of lookups\n"
+    "(READ_PCT percent) and updates on random keys, either all drawing from\n"
+    "the same KEYS keys (shared) or from a private range each (disjoint).\n"
+    "-C counts cpu events around the loop and prints them per op (native).\n"
+    "-L times every op and prints latency percentiles.\n";
+
 static uint64_t get_timestamp() {
   struct timespec ts;
   clock_gettime(CLOCK_REALTIME, &ts);
   return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
 }
 
+static int parse_args(int argc, char *argv[]) {
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      printf("%s\n", argp_program_doc);
+      exit(0);
+    }
+    if (strcmp(arg, "-C") == 0) {
+      env.counters = true;
+      continue;
+    }
+    if (strcmp(arg, "-L") == 0) {
+      env.latency = true;
+      continue;
+    }
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return -1;
+    }
+    i++;
+    if (strcmp(arg, "-t") == 0) {
+      env.threads = atoi(val);
+    } else if (strcmp(arg, "-r") == 0) {
+      env.read_pct = atoi(val);
+    } else if (strcmp(arg, "-k") == 0) {
+      env.disjoint = strcmp(val, "disjoint") == 0;
+    } else if (strcmp(arg, "-m") == 0) {
+      env.lru = strcmp(val, "lru") == 0;
+    } else if (strcmp(arg, "-n") == 0) {
+      env.ops = strtoull(val, NULL, 10);
+    } else if (strcmp(arg, "-K") == 0) {
+      env.keys = atoi(val);
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return -1;
+    }
+  }
+  if (env.threads < 0 || env.threads > MAX_THREADS || env.keys <= 0 ||
+      env.read_pct < 0 || env.read_pct > 100) {
+    fprintf(stderr, "invalid arguments\n");
+    return -1;
+  }
+  if ((uint64_t)env.keys * (env.disjoint ? env.threads : 1) > MAX_KEYS) {
+    fprintf(stderr, "at most %d keys fit in the map\n", MAX_KEYS);
+    return -1;
+  }
+  return 0;
+}
+
+static struct pmu_counters pmu;
+
+static void counters_start(void) {
+  if (env.counters)
+    pmu_start(&pmu);
+}
+
+static void counters_stop(uint64_t ops) {
+  if (!env.counters)
+    return;
+  pmu_stop(&pmu);
+  pmu_print(&pmu, ops);
+}
+
+static struct latency_hist op_hist;
+
+/* the single threaded lookup loop the benchmark started with */
+static void run_single(int mapfd) {
+  for (int64_t i = 1; i <= 100; i++) {
+    int64_t value = (i << 32) | i;
+    bpf_map_update_elem(mapfd, &i, &value, 0);
+  }
+  // uint64_t count = 0;
+  counters_start();
+  uint64_t start = get_timestamp();
+  if (env.latency) {
+    for (uint64_t i = 1; i <= env.ops; i++) {
+      int64_t key = 10;
+      int64_t value_out;
+      uint64_t t0 = cycle_clock_now();
+      bpf_map_lookup_elem(mapfd, &key, &value_out);
+      hist_record(&op_hist, cycle_clock_now() - t0);
+    }
+  } else {
+    for (uint64_t i = 1; i <= env.ops; i++) {
+      int64_t key = 10;
+      int64_t value_out;
+      bpf_map_lookup_elem(mapfd, &key, &value_out);
+      // count++;
+    }
+  }
+  uint64_t time_elapsed = get_timestamp() - start;
+  counters_stop(env.ops);
+  if (env.latency)
+    hist_print_latency(&op_hist);
+  printf("%" PRIu64 " %" PRIu64 "\n", time_elapsed, env.ops);
+}
+
+#ifdef MAP_BENCH_THREADS
+struct worker {
+  pthread_t thread;
+  int id;
+  int cpu;
+  int mapfd;
+  int64_t key_base;
+  uint32_t rng;
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t elapsed_ns;
+  /* with -L */
+  struct latency_hist *hist;
+};
+
+static int ready_workers;
+static int start_workers;
+/* set instead of start_workers when starting the workers failed midway */
+static int stop_workers;
+
+static inline uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static void pin_to_cpu(struct worker *w) {
+#ifdef NATIVE_LIBBPF
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(w->cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    fprintf(stderr, "failed to pin worker %d to cpu %d\n", w->id, w->cpu);
+#else
+  /* the host runtime owns the threads backing wasi-threads, so the guest
+   * can not pin them; pin the whole runtime with taskset instead */
+  (void)w;
+#endif
+}
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  uint64_t start;
+
+  pin_to_cpu(w);
+  __atomic_add_fetch(&ready_workers, 1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&start_workers, __ATOMIC_ACQUIRE))
+    if (__atomic_load_n(&stop_workers, __ATOMIC_ACQUIRE))
+      return NULL;
+
+  start = get_timestamp();
+  for (uint64_t i = 0; i < env.ops; i++) {
+    int64_t key = w->key_base + 1 + xorshift32(&w->rng) % env.keys;
+    int64_t value;
+    uint64_t t0 = w->hist ? cycle_clock_now() : 0;
+
+    if ((int)(xorshift32(&w->rng) % 100) < env.read_pct) {
+      bpf_map_lookup_elem(w->mapfd, &key, &value);
+      w->reads++;
+    } else {
+      value = key ^ (int64_t)i;
+      bpf_map_update_elem(w->mapfd, &key, &value, BPF_ANY);
+      w->writes++;
+    }
+    if (w->hist)
+      hist_record(w->hist, cycle_clock_now() - t0);
+  }
+  w->elapsed_ns = get_timestamp() - start;
+  return NULL;
+}
+
+/* releases the first *started* workers without running them */
+static void abort_workers(struct worker *workers, int started) {
+  __atomic_store_n(&stop_workers, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+}
+
+static int run_threaded(int mapfd) {
+  static struct worker workers[MAX_THREADS];
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int total_keys = env.keys * (env.disjoint ? env.threads : 1);
+  uint64_t start, elapsed, total_ops = 0;
+  int i, err;
+
+  if (ncpus <= 0)
+    ncpus = 1;
+  for (int64_t key = 1; key <= total_keys; key++) {
+    int64_t value = (key << 32) | key;
+    bpf_map_update_elem(mapfd, &key, &value, BPF_ANY);
+  }
+
+  for (i = 0; i < env.threads; i++) {
+    struct worker *w = &workers[i];
+
+    w->id = i;
+    w->cpu = i % ncpus;
+    w->mapfd = mapfd;
+    w->key_base = env.disjoint ? (int64_t)i * env.keys : 0;
+    w->rng = 2463534242u + i * 7919;
+    if (env.latency && !(w->hist = calloc(1, sizeof(*w->hist)))) {
+      fprintf(stderr, "failed to allocate the histogram of worker %d\n", i);
+      abort_workers(workers, i);
+      return -1;
+    }
+    err = pthread_create(&w->thread, NULL, worker_main, w);
+    if (err) {
+      fprintf(stderr, "failed to create worker %d: %d\n", i, err);
+      abort_workers(workers, i);
+      return -1;
+    }
+  }
+  while (__atomic_load_n(&ready_workers, __ATOMIC_ACQUIRE) < env.threads)
+    ;
+  counters_start();
+  start = get_timestamp();
+  __atomic_store_n(&start_workers, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < env.threads; i++)
+    pthread_join(workers[i].thread, NULL);
+  elapsed = get_timestamp() - start;
+  if (env.counters)
+    pmu_stop(&pmu);
+
+  for (i = 0; i < env.threads; i++) {
+    struct worker *w = &workers[i];
+    uint64_t ops = w->reads + w->writes;
+
+    total_ops += ops;
+    printf("thread %d cpu %d reads %" PRIu64 " writes %" PRIu64
+           " ops/sec %.0f\n",
+           w->id, w->cpu, w->reads, w->writes,
+           (double)ops * 1e9 / (double)w->elapsed_ns);
+  }
+  printf("threads %d map %s keys %s read %d%% total ops/sec %.0f\n",
+         env.threads, env.lru ? "lru" : "hash",
+         env.disjoint ? "disjoint" : "shared", env.read_pct,
+         (double)total_ops * 1e9 / (double)elapsed);
+  if (env.counters)
+    pmu_print(&pmu, total_ops);
+  if (env.latency) {
+    hist_reset(&op_hist);
+    for (i = 0; i < env.threads; i++) {
+      hist_merge(&op_hist, workers[i].hist);
+      free(workers[i].hist);
+    }
+    hist_print_latency(&op_hist);
+  }
+  printf("%" PRIu64 " %" PRIu64 "\n", elapsed, total_ops);
+  return 0;
+}
+#else
+static int run_threaded(int mapfd) {
+  fprintf(stderr, "threaded mode needs the wasm32-wasi-threads build\n");
+  return -1;
+}
+#endif
+
 int main(int argc, char *argv[]) {
   int err;
 
+  if (parse_args(argc, argv))
+    return 1;
+  if (env.latency)
+    cycle_clock_calibrate();
+  /* before the workers start, so they inherit the counters */
+  if (env.counters)
+    pmu_open(&pmu);
+
   struct map_benchmark_bpf *skel = map_benchmark_bpf__open();
   if (!skel) {
     fprintf(stderr, "Unable to open skeleton\n");
@@ -39,22 +354,15 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Unable to load\n");
     goto cleanup;
   }
-  int mapfd = bpf_map__fd(skel->maps.test_map);
-  for (int64_t i = 1; i <= 100; i++) {
-    int64_t value = (i << 32) | i;
-    bpf_map_update_elem(mapfd, &i, &value, 0);
-  }
-  // uint64_t count = 0;
-  uint64_t start = get_timestamp();
-  for (int i = 1; i <= TEST_COUNT; i++) {
-    int64_t key = 10;
-    int64_t value_out;
-    bpf_map_lookup_elem(mapfd, &key, &value_out);
-    // count++;
-  }
-  uint64_t time_elapsed = get_timestamp() - start;
-  printf("%" PRIu64 " %" PRIu64 "\n", time_elapsed, (uint64_t)TEST_COUNT);
+  int mapfd = env.lru ? bpf_map__fd(skel->maps.test_lru_map)
+                      : bpf_map__fd(skel->maps.test_map);
+  if (env.threads)
+    err = run_threaded(mapfd);
+  else
+    run_single(mapfd);
 cleanup:
+  if (env.counters)
+    pmu_close(&pmu);
   map_benchmark_bpf__destroy(skel);
   return err < 0 ? -err : 0;
 }
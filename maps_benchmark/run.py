@@ -1,10 +1,15 @@
 from typing import Union
 import pathlib
 import os
-from typing import List
+from typing import Dict, List
 from subprocess import Popen, PIPE
 import signal
+import sys
 WORK_DIR = pathlib.Path(__file__).parent
+sys.path.insert(0, str(WORK_DIR.parent))
+from harness import (generate_statistics, repeat, pin_runtime, pin_producer,  # noqa: E402
+                     environment, record_history, parse_pmu_lines, perf_stat,
+                     differential, with_ipc, flamegraph_diff, bpftime_load)
 
 ASSETS_DIR = WORK_DIR/"assets"
 
@@ -17,9 +22,10 @@ FLAME_GRAPH_ROOT = pathlib.Path("/root/FlameGraph")
 def run_simple(cmdline: List[str], perf_data_name: Union[str, None] = None, start_victim: bool = False):
     victim_pid = None
     if start_victim:
-        victim = Popen([ASSETS_DIR/"target"], cwd=ASSETS_DIR,
+        victim = Popen(pin_producer([ASSETS_DIR/"target"]), cwd=ASSETS_DIR,
                        stdout=PIPE, stdin=PIPE)
         victim_pid = victim.pid
+    cmdline = pin_runtime(cmdline)
     if perf_data_name:
         cmdline = ["perf_6.2", "record", "-g",
                    "-o", str(perf_data_name)+".perf_data",  "--", *cmdline]
@@ -41,60 +47,189 @@ def run_simple(cmdline: List[str], perf_data_name: Union[str, None] = None, star
     return time/count
 
 
-def generate_statistics(data: List[float]):
-    sqrsum = sum(x**2 for x in data)
-    avg = sum(data)/len(data)
-    sqr = sqrsum/len(data) - avg**2
-    return {
-        "max": max(data),
-        "min": min(data),
-        "sqr": sqr,
-        "avg": avg,
-        "count": len(data),
-        "raw_data": data
-    }
-
-
-def main():
-    if not os.path.exists(WORK_DIR/"result"):
-        os.mkdir(WORK_DIR/"result")
+def build_assets():
     if not os.path.exists(ASSETS_DIR):
         os.mkdir(ASSETS_DIR)
         os.system(
             f"cd {WORK_DIR/'map_benchmark'} && make clean && make -j && cp map_benchmark.wasm {ASSETS_DIR}")
+        os.system(
+            f"cd {WORK_DIR/'map_benchmark'} && make threads && cp map_benchmark_threads.wasm {ASSETS_DIR}")
         os.system(
             f"cd {WORK_DIR/'map_benchmark'} && make clean && make -f Makefile.native clean && make -f Makefile.native -j && cp map_benchmark {ASSETS_DIR}")
-    native_result_with_perf = []
-    native_result_without_perf = []
-
-    for i in range(10):
-        native_result_with_perf.append(run_simple(
-            [str(ASSETS_DIR/"map_benchmark")], WORK_DIR/"result"/f"native{i}.perf", False))
-        native_result_without_perf.append(run_simple(
-            [str(ASSETS_DIR/"map_benchmark")]))
-    wasm_result_with_perf = []
-    wasm_result_without_perf = []
-    for i in range(10):
-        wasm_result_with_perf.append(run_simple(
-            [WASM_BPF, str(ASSETS_DIR/"map_benchmark.wasm")], WORK_DIR/"result"/f"wasm{i}.perf"))
-        wasm_result_without_perf.append(run_simple(
-            [WASM_BPF, str(ASSETS_DIR/"map_benchmark.wasm")], None))
-    docker_result = []
-    for i in range(10):
-        docker_result.append(
-            run_simple(["docker", "run", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE], None))
+
+
+THREAD_RUN_COUNT = 3
+READ_PERCENTS = [100, 90, 50]
+
+
+def thread_counts() -> List[int]:
+    counts = []
+    n = 1
+    while n <= (os.cpu_count() or 1):
+        counts.append(n)
+        n *= 2
+    return counts
+
+
+def run_thread_scaling():
+    """Sweep the threaded mode over thread count, map type, key sharing and
+    read ratio, and record the aggregate ops/sec of every configuration."""
+    runtimes = {
+        "native": [str(ASSETS_DIR/"map_benchmark")],
+        "wasm": [WASM_BPF, str(ASSETS_DIR/"map_benchmark_threads.wasm")],
+    }
+    build_assets()
+    result = {"environment": environment()}
+    for runtime, cmdline in runtimes.items():
+        result[runtime] = {}
+        for map_type in ["hash", "lru"]:
+            for keys in ["shared", "disjoint"]:
+                for read_pct in READ_PERCENTS:
+                    name = f"{map_type}/{keys}/read{read_pct}"
+                    result[runtime][name] = {}
+                    for threads in thread_counts():
+                        args = ["-t", str(threads), "-m", map_type, "-k", keys, "-r", str(read_pct)]
+                        ops_per_sec = repeat(lambda _: 1e9/run_simple([*cmdline, *args]), THREAD_RUN_COUNT)
+                        result[runtime][name][threads] = generate_statistics(
+                            ops_per_sec, "higher")
+    print(result)
+    import json
+    with open("result_threads.json", "w") as f:
+        json.dump(result, f)
+    record_history("maps_benchmark", "result_threads.json", result)
+
+
+PMU_RUN_COUNT = 5
+PMU_OPS = 1000000
+
+
+def run_lines(cmdline: List[str]) -> List[str]:
+    print(cmdline)
+    proc = Popen(pin_runtime(cmdline), text=True, stdout=PIPE, cwd=ASSETS_DIR)
+    return proc.communicate()[0].splitlines()
+
+
+def pmu_statistics(samples: List[Dict[str, float]]):
+    events = sorted({event for sample in samples for event in sample})
+    return {event: generate_statistics([s[event] for s in samples if event in s],
+                                       "higher" if event == "ipc" else "lower")
+            for event in events}
+
+
+def perf_stat_per_op(cmdline: List[str]) -> Dict[str, float]:
+    """perf stat of a run with PMU_OPS lookups minus one with none"""
+    full, _ = perf_stat(pin_runtime([*cmdline, "-n", str(PMU_OPS)]))
+    base, _ = perf_stat(pin_runtime([*cmdline, "-n", "0"]))
+    return with_ipc(differential(full, base, PMU_OPS))
+
+
+def run_pmu():
+    """Instructions, cycles, cache and branch misses, context switches and
+    page faults per lookup. The native build counts around the loop itself
+    (-C); the wasm guest can not, so both are also measured the same way from
+    the outside with perf stat."""
+    build_assets()
+    native = [str(ASSETS_DIR/"map_benchmark")]
+    wasm = [str(WASM_BPF), str(ASSETS_DIR/"map_benchmark.wasm")]
+    result = {
+        "environment": environment(),
+        "native": pmu_statistics(repeat(lambda _: with_ipc(parse_pmu_lines(
+            run_lines([*native, "-C", "-n", str(PMU_OPS)]))), PMU_RUN_COUNT)),
+        "native_perf_stat": pmu_statistics(repeat(lambda _: perf_stat_per_op(native), PMU_RUN_COUNT)),
+        "wasm_perf_stat": pmu_statistics(repeat(lambda _: perf_stat_per_op(wasm), PMU_RUN_COUNT)),
+    }
+    print(result)
+    import json
+    with open("result_pmu.json", "w") as f:
+        json.dump(result, f)
+    record_history("maps_benchmark", "result_pmu.json", result)
+
+
+LATENCY_RUN_COUNT = 5
+LATENCY_PERCENTILES = ["p50", "p90", "p99", "p999", "p9999", "max"]
+
+
+def parse_latency(lines: List[str]) -> Dict[str, float]:
+    """latency ns p50 <n> p90 <n> ... max <n>"""
+    for line in lines:
+        if line.startswith("latency ns "):
+            fields = line.split()[2:]
+            return {name: float(value) for name, value in zip(fields[::2], fields[1::2])}
+    raise ValueError("no latency line in the output")
+
+
+def run_latency():
+    """Per lookup latency percentiles from -L, single threaded and with all
+    CPUs busy, for native and wasm"""
+    build_assets()
+    # arguments and wasm module of each configuration: only the threaded one
+    # needs the wasi-threads build, single uses the module of the other runs
+    configs = {
+        "single": ([], "map_benchmark.wasm"),
+        f"threads{os.cpu_count()}": (["-t", str(os.cpu_count()), "-r", "100"], "map_benchmark_threads.wasm"),
+    }
+    runtimes = {
+        "native": lambda _: [str(ASSETS_DIR/"map_benchmark")],
+        "wasm": lambda module: [WASM_BPF, str(ASSETS_DIR/module)],
+    }
+    result = {"environment": environment()}
+    for runtime, cmdline in runtimes.items():
+        result[runtime] = {}
+        for name, (args, module) in configs.items():
+            samples = repeat(lambda _: parse_latency(run_lines([*cmdline(module), "-L", *args])), LATENCY_RUN_COUNT)
+            result[runtime][name] = {
+                pct: generate_statistics([s[pct] for s in samples], "lower") for pct in LATENCY_PERCENTILES
+            }
+    print(result)
+    import json
+    with open("result_latency.json", "w") as f:
+        json.dump(result, f)
+    record_history("maps_benchmark", "result_latency.json", result)
+
+
+def main():
+    if not os.path.exists(WORK_DIR/"result"):
+        os.mkdir(WORK_DIR/"result")
+    build_assets()
+    # no warmup for the runs under perf, they only feed the flame graphs
+    native_result_with_perf = repeat(lambda i: run_simple(
+        [str(ASSETS_DIR/"map_benchmark")], WORK_DIR/"result"/f"native{i}.perf", False), 10, 0)
+    native_result_without_perf = repeat(lambda _: run_simple(
+        [str(ASSETS_DIR/"map_benchmark")]), 10)
+    wasm_result_with_perf = repeat(lambda i: run_simple(
+        [WASM_BPF, str(ASSETS_DIR/"map_benchmark.wasm")], WORK_DIR/"result"/f"wasm{i}.perf"), 10, 0)
+    wasm_result_without_perf = repeat(lambda _: run_simple(
+        [WASM_BPF, str(ASSETS_DIR/"map_benchmark.wasm")], None), 10)
+    # the native binary with test_map in shared memory
+    bpftime_result = repeat(lambda _: run_simple(
+        bpftime_load([str(ASSETS_DIR/"map_benchmark")])), 10)
+    docker_result = repeat(lambda _: run_simple(
+        ["docker", "run", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE], None), 10)
+    # run_simple returns nanoseconds per lookup
     result = {
-        "native_perf": generate_statistics(native_result_with_perf),
-        "native_no_perf": generate_statistics(native_result_without_perf),
-        "wasm_perf": generate_statistics(wasm_result_with_perf),
-        "wasm_no_perf": generate_statistics(wasm_result_without_perf),
-        "docker": generate_statistics(docker_result)
+        "environment": environment(),
+        "native_perf": generate_statistics(native_result_with_perf, "lower"),
+        "native_no_perf": generate_statistics(native_result_without_perf, "lower"),
+        "wasm_perf": generate_statistics(wasm_result_with_perf, "lower"),
+        "wasm_no_perf": generate_statistics(wasm_result_without_perf, "lower"),
+        "bpftime_no_perf": generate_statistics(bpftime_result, "lower"),
+        "docker": generate_statistics(docker_result, "lower"),
+        # wasm minus native samples per run in result/diff.svg, by bucket
+        "overhead_buckets": flamegraph_diff(WORK_DIR/"result"),
     }
     print(result)
     import json
     with open("result.json", "w") as f:
         json.dump(result, f)
+    record_history("maps_benchmark", "result.json", result)
 
 
 if __name__ == "__main__":
-    main()
+    if len(sys.argv) > 1 and sys.argv[1] == "threads":
+        run_thread_scaling()
+    elif len(sys.argv) > 1 and sys.argv[1] == "pmu":
+        run_pmu()
+    elif len(sys.argv) > 1 and sys.argv[1] == "latency":
+        run_latency()
+    else:
+        main()
@@ -0,0 +1,112 @@
+import pathlib
+import shutil
+import os
+import subprocess
+import time
+import signal
+import sys
+from typing import Dict
+WORK_DIR = pathlib.Path(__file__).parent
+PROJECT_ROOT = WORK_DIR.parent
+sys.path.insert(0, str(PROJECT_ROOT))
+from harness import (generate_statistics, repeat, pin_runtime, environment, record_history,  # noqa: E402
+                     read_smaps_rollup, read_memlock)
+ASSETS_DIR = WORK_DIR/"assets"
+WASM_BPF = PROJECT_ROOT/"assets"/"wasm-bpf"
+RUN_COUNT = 5
+# seconds to wait before sampling, so loading and buffer setup are done
+SETTLE_SECONDS = 3
+SAMPLE_COUNT = 5
+TOOLS = ["bootstrap", "runqlat", "opensnoop", "execve"]
+MODES = ["native", "wasm", "docker"]
+
+
+def docker_image(tool: str) -> str:
+    return f"wasm-bpf-memory-{tool}"
+
+
+def build_assets():
+    if not os.path.exists(ASSETS_DIR):
+        os.makedirs(ASSETS_DIR/"native")
+        os.makedirs(ASSETS_DIR/"wasm")
+        for tool in TOOLS:
+            root = PROJECT_ROOT/"examples"/tool
+            os.system(f"cd {root} && make clean && make -j")
+            shutil.copy(root/f"{tool}.wasm", ASSETS_DIR/"wasm")
+            os.system(f"cd {root} && make clean")
+            os.system(
+                f"cd {root} && make -f Makefile.native clean && make -f Makefile.native -j")
+            shutil.copy(root/tool, ASSETS_DIR/"native")
+            os.system(
+                f"cd {WORK_DIR} && docker build --build-arg TOOL={tool} -t {docker_image(tool)} .")
+
+
+def start_tool(tool: str, mode: str) -> subprocess.Popen:
+    if mode == "native":
+        cmd = [str(ASSETS_DIR/"native"/tool)]
+    elif mode == "wasm":
+        cmd = [str(WASM_BPF), str(ASSETS_DIR/"wasm"/f"{tool}.wasm")]
+    else:
+        cmd = ["docker", "run", "--rm", "--privileged", "-v", "/sys:/sys",
+               "--name", docker_image(tool), docker_image(tool)]
+    cmd = pin_runtime(cmd)
+    print(cmd)
+    return subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, cwd=ASSETS_DIR)
+
+
+def tool_pid(tool: str, mode: str, proc: subprocess.Popen) -> int:
+    """The process holding the bpf objects: the tool itself, the wasm-bpf
+    runtime, or the container's entrypoint as seen from the host"""
+    if mode != "docker":
+        return proc.pid
+    out = subprocess.check_output(
+        ["docker", "inspect", "-f", "{{.State.Pid}}", docker_image(tool)], text=True)
+    return int(out.strip())
+
+
+def stop_tool(tool: str, mode: str, proc: subprocess.Popen):
+    if mode == "docker":
+        # the container does not forward SIGTERM to the tool
+        os.system(f"docker kill {docker_image(tool)}")
+    else:
+        proc.send_signal(signal.SIGTERM)
+    proc.wait()
+
+
+def run_once(tool: str, mode: str) -> Dict[str, float]:
+    """Average of SAMPLE_COUNT samples taken a second apart at steady state"""
+    proc = start_tool(tool, mode)
+    time.sleep(SETTLE_SECONDS)
+    samples = []
+    try:
+        pid = tool_pid(tool, mode, proc)
+        for _ in range(SAMPLE_COUNT):
+            samples.append({**read_smaps_rollup(pid), **read_memlock(pid)})
+            time.sleep(1)
+    finally:
+        stop_tool(tool, mode, proc)
+    result = {key: sum(x[key] for x in samples) / len(samples) for key in samples[0]}
+    print(tool, mode, result)
+    return result
+
+
+def main():
+    build_assets()
+    result = {"environment": environment()}
+    for tool in TOOLS:
+        result[tool] = {}
+        for mode in MODES:
+            # memory does not need warming up, only the timing benchmarks do
+            runs = repeat(lambda _: run_once(tool, mode), RUN_COUNT, 0)
+            result[tool][mode] = {
+                key: generate_statistics([run[key] for run in runs], "lower") for key in runs[0]
+            }
+    print(result)
+    import json
+    with open(WORK_DIR/"result.json", "w") as f:
+        json.dump(result, f)
+    record_history("memory_benchmark", "result.json", result)
+
+
+if __name__ == "__main__":
+    main()
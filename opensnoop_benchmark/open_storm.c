@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+static struct env {
+  int threads;
+  int duration;
+  const char *path;
+} env = {
+    .threads = 1,
+    .duration = 10,
+    .path = "/dev/null",
+};
+
+const char argp_program_doc[] =
+    "open() storm for the opensnoop benchmark: opens and closes a file in a\n"
+    "loop, as fast as it can.\n"
+    "\n"
+    "USAGE: open_storm [-t THREADS] [-d SEC] [-f PATH]\n"
+    "\n"
+    "  -t  threads opening the file, 1 by default\n"
+    "  -d  stop after SEC seconds, 10 by default\n"
+    "  -f  file to open, /dev/null by default\n"
+    "\n"
+    "On exit it prints the achieved rate:\n"
+    "  storm threads <n> opens <n> elapsed_ns <n> rate <opens per sec>\n";
+
+static atomic_bool stop;
+
+static uint64_t get_monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *storm(void *arg) {
+  uint64_t opens = 0;
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    int fd = open(env.path, O_RDONLY);
+
+    if (fd >= 0)
+      close(fd);
+    opens++;
+  }
+  /* count locally, the threads would share the cache line of opens[] */
+  *(uint64_t *)arg = opens;
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  pthread_t threads[MAX_THREADS];
+  uint64_t opens[MAX_THREADS] = {};
+  uint64_t start, elapsed, total = 0;
+
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      printf("%s", argp_program_doc);
+      return 0;
+    }
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 1;
+    }
+    i++;
+    if (strcmp(arg, "-t") == 0) {
+      env.threads = atoi(val);
+    } else if (strcmp(arg, "-d") == 0) {
+      env.duration = atoi(val);
+    } else if (strcmp(arg, "-f") == 0) {
+      env.path = val;
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 1;
+    }
+  }
+  if (env.threads < 1 || env.threads > MAX_THREADS) {
+    fprintf(stderr, "between 1 and %d threads\n", MAX_THREADS);
+    return 1;
+  }
+
+  start = get_monotonic();
+  for (int i = 0; i < env.threads; i++)
+    pthread_create(&threads[i], NULL, storm, &opens[i]);
+  sleep(env.duration);
+  atomic_store(&stop, true);
+  for (int i = 0; i < env.threads; i++) {
+    pthread_join(threads[i], NULL);
+    total += opens[i];
+  }
+  elapsed = get_monotonic() - start;
+  printf("storm threads %d opens %lu elapsed_ns %lu rate %f\n", env.threads,
+         (unsigned long)total, (unsigned long)elapsed,
+         total * 1e9 / elapsed);
+  return 0;
+}
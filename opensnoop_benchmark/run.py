@@ -0,0 +1,120 @@
+import json
+import pathlib
+import os
+import subprocess
+import time
+import sys
+from typing import Dict, List, Union
+WORK_DIR = pathlib.Path(__file__).parent
+PROJECT_ROOT = WORK_DIR.parent
+sys.path.insert(0, str(PROJECT_ROOT))
+from harness import generate_statistics, repeat, pin_runtime, pin_producer, environment, record_history  # noqa: E402
+ASSETS_DIR = WORK_DIR/"assets"
+WASM_BPF = PROJECT_ROOT/"assets"/"wasm-bpf"
+RUN_COUNT = 5
+# seconds to wait after starting opensnoop, so it has loaded and attached
+SETTLE_SECONDS = 3
+STORM_SECONDS = 10
+STORM_THREADS = max(1, (os.cpu_count() or 1) // 2)
+RUNTIMES = ["native", "wasm"]
+# opensnoop arguments of each mode: the storm is named open_storm, so nomatch
+# filters all of it out, in the kernel or after it arrived with -N
+MODES = {
+    "kernel_filter": ["-n", "nomatch"],
+    "user_filter": ["-n", "nomatch", "-N"],
+    "match": ["-n", "open_storm"],
+}
+CLOCK_TICKS = os.sysconf("SC_CLK_TCK")
+
+
+def build_assets():
+    if not os.path.exists(ASSETS_DIR):
+        os.makedirs(ASSETS_DIR)
+        root = PROJECT_ROOT/"examples"/"opensnoop"
+        os.system(f"cd {root} && make clean && make -j && cp opensnoop.wasm {ASSETS_DIR}")
+        os.system(f"cd {root} && make clean")
+        os.system(f"cd {root} && make -f Makefile.native clean && make -f Makefile.native -j && cp opensnoop {ASSETS_DIR}")
+        os.system(f"cc -O2 -pthread {WORK_DIR/'open_storm.c'} -o {ASSETS_DIR/'open_storm'}")
+
+
+def cpu_seconds(pid: int) -> float:
+    """user and system time of the process so far"""
+    with open(f"/proc/{pid}/stat") as f:
+        fields = f.read().rpartition(")")[2].split()
+    # utime and stime are fields 14 and 15, the list starts at field 3
+    return (int(fields[11]) + int(fields[12])) / CLOCK_TICKS
+
+
+def run_storm() -> float:
+    """opens per second of the storm"""
+    out = subprocess.check_output(pin_producer(
+        [str(ASSETS_DIR/"open_storm"), "-t", str(STORM_THREADS), "-d", str(STORM_SECONDS)]), text=True)
+    for line in out.splitlines():
+        if line.startswith("storm threads"):
+            return float(line.split()[-1])
+    raise ValueError("no rate in the open_storm output")
+
+
+def run_once(runtime: Union[str, None], args: List[str]) -> Dict[str, float]:
+    """Rate of the storm, and how many events per second reached opensnoop and
+    how much CPU it used meanwhile, or only the rate without opensnoop if
+    runtime is None"""
+    if runtime is None:
+        return {"opens_per_sec": run_storm()}
+    duration = ["-d", str(SETTLE_SECONDS + STORM_SECONDS + 2)]
+    if runtime == "native":
+        cmd = [str(ASSETS_DIR/"opensnoop"), *args, *duration, "-s"]
+    else:
+        cmd = [str(WASM_BPF), str(ASSETS_DIR/"opensnoop.wasm"), *args, *duration, "-s"]
+    cmd = pin_runtime(cmd)
+    print(cmd)
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True, cwd=ASSETS_DIR)
+    try:
+        time.sleep(SETTLE_SECONDS)
+        cpu_before = cpu_seconds(proc.pid)
+        start = time.monotonic()
+        opens_per_sec = run_storm()
+        elapsed = time.monotonic() - start
+        cpu = cpu_seconds(proc.pid) - cpu_before
+    except BaseException:
+        proc.kill()
+        raise
+    _, err = proc.communicate()
+    # events <n> printed <n> lost <n> drops <n>
+    summary = [line for line in err.splitlines() if line.startswith("events ")][-1].split()
+    result = {
+        "opens_per_sec": opens_per_sec,
+        "events_per_sec": int(summary[1]) / elapsed,
+        "printed_per_sec": int(summary[3]) / elapsed,
+        "lost": int(summary[5]),
+        "drops": int(summary[7]),
+        "consumer_cpu": cpu / elapsed,
+    }
+    print(runtime, args, result)
+    return result
+
+
+def main():
+    """opensnoop under an open() storm that its name filter drops, with the
+    filter in the kernel and in user space"""
+    build_assets()
+    result = {"environment": environment()}
+    baseline = repeat(lambda _: run_once(None, []), RUN_COUNT)
+    result["no_probe"] = {"opens_per_sec": generate_statistics([r["opens_per_sec"] for r in baseline], "higher")}
+    better = {"opens_per_sec": "higher", "events_per_sec": None, "printed_per_sec": None,
+              "lost": "lower", "drops": "lower", "consumer_cpu": "lower"}
+    for runtime in RUNTIMES:
+        result[runtime] = {}
+        for mode, args in MODES.items():
+            runs = repeat(lambda _: run_once(runtime, args), RUN_COUNT)
+            result[runtime][mode] = {
+                key: generate_statistics([run[key] for run in runs], better[key]) for key in runs[0]
+            }
+    print(result)
+    with open(WORK_DIR/"result.json", "w") as f:
+        json.dump(result, f)
+    record_history("opensnoop_benchmark", "result.json", result)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,10 +1,17 @@
 from typing import Union
 import pathlib
 import os
-from typing import List
+import time
+from typing import Dict, List, Tuple
 from subprocess import Popen, PIPE
 import signal
+import sys
 WORK_DIR = pathlib.Path(__file__).parent
+sys.path.insert(0, str(WORK_DIR.parent))
+from harness import (generate_statistics, repeat, pin_runtime, pin_producer,  # noqa: E402
+                     producer_first_cpu, environment, record_history, parse_pmu_lines,
+                     perf_stat, differential, with_ipc, flamegraph_diff,
+                     bpftime_load, bpftime_start, read_smaps_rollup, read_memlock)
 
 ASSETS_DIR = WORK_DIR/"assets"
 
@@ -14,87 +21,432 @@ DOCKER_IMAGE = "ec8e70be5d9d"
 FLAME_GRAPH_ROOT = pathlib.Path("/root/FlameGraph")
 
 
-def run_simple(cmdline: List[str], perf_data_name: Union[str, None] = None, start_victim: bool = False):
-    victim_pid = None
-    if start_victim:
-        victim = Popen([ASSETS_DIR/"target"], cwd=ASSETS_DIR,
-                       stdout=PIPE, stdin=PIPE)
-        victim_pid = victim.pid
+def producer_rate(lines: List[str]) -> float:
+    """Sum the achieved rates reported by target.c on exit:
+    producer threads <n> calls <n> elapsed_ns <n> rate <calls per sec>"""
+    return sum(float(line.split()[-1]) for line in lines if line.startswith("producer threads"))
+
+
+def producer_args() -> List[str]:
+    """Pin the ./target threads to HARNESS_PRODUCER_CPUS, target.c pins them
+    itself so taskset alone would be overridden"""
+    first_cpu = producer_first_cpu()
+    return [] if first_cpu is None else ["-c", str(first_cpu)]
+
+
+def run_process(cmdline: List[str], perf_data_name: Union[str, None] = None, start_victim: Union[bool, int] = False,
+                victim_args: List[str] = [], bpftime: bool = False) -> Tuple[List[float], float]:
+    """Run one benchmark process and return the numbers on its last line,
+    together with the event rate the producers achieved.
+
+    start_victim is the number of ./target producers to start beside it, the
+    native build forks its own. With bpftime they are started under the
+    bpftime agent, once the consumer reports that it attached."""
+    victims = []
+
+    def start_victims():
+        for index in range(int(start_victim)):
+            # each process takes the next CPUs after those of the one before
+            victim = [ASSETS_DIR/"target", *victim_args, *producer_args(), "-i", str(index)]
+            if bpftime:
+                victim = bpftime_start(victim)
+            victims.append(Popen(pin_producer(victim), cwd=ASSETS_DIR,
+                                 text=True, stdout=PIPE, stdin=PIPE))
+    if not bpftime:
+        start_victims()
+    cmdline = pin_runtime(cmdline)
     if perf_data_name:
         cmdline = ["perf_6.2", "record", "-g",
                    "-o", str(perf_data_name)+".perf_data",  "--", *cmdline]
     print(cmdline)
-    proc = Popen(cmdline, text=True, stdout=PIPE, cwd=ASSETS_DIR)
+    proc = Popen(cmdline, text=True, stdout=PIPE, stderr=PIPE, cwd=ASSETS_DIR)
 
-    lines = proc.stdout.readlines()
+    lines = []
+    if bpftime:
+        # the agent only picks up the probes that are in shared memory when
+        # the producer starts
+        for line in proc.stdout:
+            lines.append(line)
+            if line.startswith("Load and attach"):
+                break
+        start_victims()
+    out, err = proc.communicate()
+    lines += out.splitlines(keepends=True)
+    producer_lines = err.splitlines()
     if perf_data_name:
         os.system(
             f"perf_6.2 script -i {str(perf_data_name)+'.perf_data'} > {perf_data_name}")
         os.remove(str(perf_data_name)+".perf_data")
         os.system(f"{FLAME_GRAPH_ROOT/'stackcollapse-perf.pl'} < {str(perf_data_name)} | {FLAME_GRAPH_ROOT/'flamegraph.pl'} > {str(perf_data_name)+'.svg'}")
-    if start_victim:
+    for victim in victims:
         victim.send_signal(signal.SIGINT)
-        victim.wait()
+        producer_lines += victim.communicate()[0].splitlines()
     print(lines)
+    if proc.returncode and not any(line.startswith("Total nanoseconds") for line in lines):
+        # stopped before measuring, e.g. uprobe -l refusing a clock with another origin
+        raise RuntimeError(f"{cmdline} failed before its results: {err.strip()}")
     data_line = lines[-1]
-    time, count = (float(x) for x in data_line.strip().split())
+    return [float(x) for x in data_line.strip().split()], producer_rate(producer_lines)
+
+
+def run_simple(cmdline: List[str], perf_data_name: Union[str, None] = None, start_victim: Union[bool, int] = False,
+               bpftime: bool = False):
+    (time, count, *_), _ = run_process(cmdline, perf_data_name, start_victim, bpftime=bpftime)
+    if perf_data_name:
+        # the runs last a fixed time, the flame graphs divide by the events
+        with open(str(perf_data_name) + ".events", "w") as f:
+            f.write(f"{count:.0f}\n")
     return time/count
 
 
-def generate_statistics(data: List[float]):
-    sqrsum = sum(x**2 for x in data)
-    avg = sum(data)/len(data)
-    sqr = sqrsum/len(data) - avg**2
-    return {
-        "max": max(data),
-        "min": min(data),
-        "sqr": sqr,
-        "avg": avg,
-        "count": len(data),
-        "raw_data": data
-    }
+SWEEP_RUN_COUNT = 3
+SWEEP_SECONDS = 3
+EVENT_SIZES = [16, 64, 256, 1024, 4096]
+RINGBUF_SIZES = [64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024]
+PRODUCER_THREADS = [1, 2, 4]
+# ./target processes, each with PRODUCER_THREADS threads
+PRODUCER_PROCESSES = [1, 2]
+POLL_MODES = ["poll", "busy"]
+WAKEUP_BATCHES = [0, 1, 16, 256]
+LATENCY_RATE = 100000
+TRANSPORTS = ["ringbuf", "perfbuf"]
+TRANSPORT_EVENT_SIZES = [16, 256, 4096]
+# seconds the producers run before the memory of the consumer is read, so
+# the buffer pages it maps have been touched
+MEMORY_SETTLE_SECONDS = 1
 
 
-def main():
-    if not os.path.exists(WORK_DIR/"result"):
-        os.mkdir(WORK_DIR/"result")
+def build_assets():
     if not os.path.exists(ASSETS_DIR):
         os.mkdir(ASSETS_DIR)
         os.system(
             f"cd {WORK_DIR/'uprobe'} && make clean && make -j && cp target {ASSETS_DIR} && cp uprobe.wasm {ASSETS_DIR}")
+        # the wasm sdk can not resize maps, so build one module per ring buffer size
+        for size in RINGBUF_SIZES:
+            os.system(
+                f"cd {WORK_DIR/'uprobe'} && make clean && make RINGBUF_SIZE={size} uprobe.wasm && cp uprobe.wasm {ASSETS_DIR/f'uprobe-{size}.wasm'}")
         os.system(
             f"cd {WORK_DIR/'uprobe'} && make clean && make -f Makefile.native clean && make -f Makefile.native -j && cp uprobe {ASSETS_DIR}")
-    native_result_with_perf = []
-    native_result_without_perf = []
-
-    for i in range(10):
-        native_result_with_perf.append(run_simple(
-            [str(ASSETS_DIR/"uprobe")], WORK_DIR/"result"/f"native{i}.perf", False))
-        native_result_without_perf.append(run_simple(
-            [str(ASSETS_DIR/"uprobe")]))
-    wasm_result_with_perf = []
-    wasm_result_without_perf = []
-    for i in range(10):
-        wasm_result_with_perf.append(run_simple(
-            [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm")], WORK_DIR/"result"/f"wasm{i}.perf", True))
-        wasm_result_without_perf.append(run_simple(
-            [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm")], None, True))
-    docker_result = []
-    for i in range(10):
-        docker_result.append(
-            run_simple(["docker", "run", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE], None))
+
+
+# names of the numbers on the last line of uprobe.c
+RESULT_COLUMNS = ["elapsed", "events", "bytes", "drops", "cpu",
+                  "p50", "p99", "p999", "max", "inversions", "backward", "skewed"]
+
+
+def sweep_statistics(samples: List[Tuple[List[float], float]]):
+    """samples holds the last line of every run and the rate the producers
+    offered"""
+    rows = [dict(zip(RESULT_COLUMNS, x)) for x, _ in samples]
+    def column(f, better): return generate_statistics([f(r) for r in rows], better)
+    return {
+        "offered_events_per_sec": generate_statistics([rate for _, rate in samples]),
+        "events_per_sec": column(lambda r: r["events"] * 1e9 / r["elapsed"], "higher"),
+        "bytes_per_sec": column(lambda r: r["bytes"] * 1e9 / r["elapsed"], "higher"),
+        "drops": column(lambda r: r["drops"], "lower"),
+        "consumer_cpu": column(lambda r: r["cpu"] / r["elapsed"], "lower"),
+        "inversions_per_event": column(lambda r: r["inversions"] / max(r["events"], 1), "lower"),
+        "max_backward_ns": column(lambda r: r["backward"], "lower"),
+    }
+
+
+def latency_statistics(samples: List[Tuple[List[float], float]]):
+    rows = [dict(zip(RESULT_COLUMNS, x)) for x, _ in samples]
+    # a record stamped after it arrived means the consumer clock is not the
+    # kernel CLOCK_MONOTONIC, as under a WASI runtime with its own origin
+    if any(r["skewed"] for r in rows):
+        raise ValueError(f"{sum(r['skewed'] for r in rows):.0f} skewed records, the latencies are meaningless")
+    result = sweep_statistics(samples)
+    for name in ["p50", "p99", "p999", "max"]:
+        result[f"latency_{name}_ns"] = generate_statistics(
+            [r[name] for r in rows], "lower")
+    return result
+
+
+def run_sweep():
+    """Sweep record size, ring buffer size, producer processes and threads
+    per process for a fixed duration each, for the native and the wasm
+    consumer."""
+    build_assets()
+    result = {"environment": environment(), "native": {}, "wasm": {}}
+    for ringbuf_size in RINGBUF_SIZES:
+        for event_size in EVENT_SIZES:
+            for procs in PRODUCER_PROCESSES:
+                for threads in PRODUCER_THREADS:
+                    name = f"rb{ringbuf_size}/size{event_size}/procs{procs}/threads{threads}"
+                    args = ["-s", str(event_size), "-d", str(SWEEP_SECONDS)]
+                    native = repeat(lambda _: run_process(
+                        [str(ASSETS_DIR/"uprobe"), *args, "-b", str(ringbuf_size), "-p", str(procs),
+                         "-t", str(threads), *producer_args()]),
+                        SWEEP_RUN_COUNT)
+                    wasm = repeat(lambda _: run_process(
+                        [WASM_BPF, str(ASSETS_DIR/f"uprobe-{ringbuf_size}.wasm"), *args], None, procs,
+                        ["-t", str(threads)]),
+                        SWEEP_RUN_COUNT)
+                    result["native"][name] = sweep_statistics(native)
+                    result["wasm"][name] = sweep_statistics(wasm)
+    print(result)
+    import json
+    with open("result_sweep.json", "w") as f:
+        json.dump(result, f)
+    record_history("ringbuf_benchmark", "result_sweep.json", result)
+
+
+def run_latency():
+    """Delivery latency from bpf_ringbuf_submit to the consumer callback for
+    every poll mode and wakeup batch, at a fixed offered rate so the numbers
+    are not dominated by a full ring buffer."""
+    build_assets()
+    result = {"environment": environment(), "native": {}, "wasm": {}}
+    for mode in POLL_MODES:
+        for batch in WAKEUP_BATCHES:
+            name = f"{mode}/batch{batch}"
+            args = ["-l", "-m", mode, "-w", str(batch), "-d", str(SWEEP_SECONDS)]
+            producer = ["-r", str(LATENCY_RATE)]
+            native = repeat(lambda _: run_process(
+                [str(ASSETS_DIR/"uprobe"), *args, *producer, *producer_args()]), SWEEP_RUN_COUNT)
+            wasm = repeat(lambda _: run_process(
+                [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm"), *args], None, 1, producer), SWEEP_RUN_COUNT)
+            result["native"][name] = latency_statistics(native)
+            result["wasm"][name] = latency_statistics(wasm)
+    print(result)
+    import json
+    with open("result_latency.json", "w") as f:
+        json.dump(result, f)
+    record_history("ringbuf_benchmark", "result_latency.json", result)
+
+
+def buffer_memory(cmdline: List[str], start_victim: int, victim_args: List[str] = []) -> Dict[str, int]:
+    """Rss of the consumer and the memlock of the maps it holds open, read
+    once its buffer is loaded and events flow; a perf buffer has a data
+    area per CPU, so on this machine it is charged environment.cpu_count
+    times"""
+    cmdline = pin_runtime(cmdline)
+    print(cmdline)
+    proc = Popen(cmdline, text=True, stdout=PIPE, stderr=PIPE, cwd=ASSETS_DIR)
+    victims = []
+    try:
+        for line in proc.stdout:
+            if line.startswith("Load and attach"):
+                break
+        for index in range(start_victim):
+            victims.append(Popen(pin_producer([ASSETS_DIR/"target", *victim_args, *producer_args(), "-i", str(index)]),
+                                 cwd=ASSETS_DIR, text=True, stdout=PIPE))
+        time.sleep(MEMORY_SETTLE_SECONDS)
+        memlock = read_memlock(proc.pid)
+        result = {"rss": read_smaps_rollup(proc.pid)["rss"], "map_memlock": memlock["map_memlock"]}
+    finally:
+        proc.communicate()
+        for victim in victims:
+            victim.send_signal(signal.SIGINT)
+            victim.communicate()
+    print(result)
+    return result
+
+
+def run_transport():
+    """Emit the same records through a ring buffer and a perf event array and
+    compare throughput, drops, consumer CPU and ordering for native and wasm."""
+    build_assets()
+    result = {"environment": environment(), "native": {}, "wasm": {}, "memory_bytes": {"native": {}, "wasm": {}}}
+    for transport in TRANSPORTS:
+        args = ["-T", transport, "-d", str(SWEEP_SECONDS)]
+        native = repeat(lambda _: buffer_memory([str(ASSETS_DIR/"uprobe"), *args, *producer_args()], 0),
+                        SWEEP_RUN_COUNT)
+        wasm = repeat(lambda _: buffer_memory([WASM_BPF, str(ASSETS_DIR/"uprobe.wasm"), *args], 1),
+                      SWEEP_RUN_COUNT)
+        for runtime, samples in (("native", native), ("wasm", wasm)):
+            result["memory_bytes"][runtime][transport] = {
+                key: generate_statistics([s[key] for s in samples], "lower") for key in samples[0]}
+    for transport in TRANSPORTS:
+        for event_size in TRANSPORT_EVENT_SIZES:
+            for threads in PRODUCER_THREADS:
+                name = f"{transport}/size{event_size}/threads{threads}"
+                args = ["-T", transport, "-s", str(event_size), "-d", str(SWEEP_SECONDS)]
+                native = repeat(lambda _: run_process(
+                    [str(ASSETS_DIR/"uprobe"), *args, "-t", str(threads), *producer_args()]), SWEEP_RUN_COUNT)
+                wasm = repeat(lambda _: run_process(
+                    [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm"), *args], None, 1, ["-t", str(threads)]),
+                    SWEEP_RUN_COUNT)
+                result["native"][name] = sweep_statistics(native)
+                result["wasm"][name] = sweep_statistics(wasm)
+    print(result)
+    import json
+    with open("result_transport.json", "w") as f:
+        json.dump(result, f)
+    record_history("ringbuf_benchmark", "result_transport.json", result)
+
+
+PMU_RUN_COUNT = 5
+
+
+def pmu_statistics(samples: List[Dict[str, float]]):
+    events = sorted({event for sample in samples for event in sample})
+    return {event: generate_statistics([s[event] for s in samples if event in s],
+                                       "higher" if event == "ipc" else "lower")
+            for event in events}
+
+
+def native_pmu() -> Dict[str, float]:
+    """Counters of the native consumer per event, from -C"""
+    cmdline = pin_runtime([str(ASSETS_DIR/"uprobe"), "-C", "-d", str(SWEEP_SECONDS), *producer_args()])
+    print(cmdline)
+    proc = Popen(cmdline, text=True, stdout=PIPE, stderr=PIPE, cwd=ASSETS_DIR)
+    return with_ipc(parse_pmu_lines(proc.communicate()[0].splitlines()))
+
+
+def wasm_pmu() -> Dict[str, float]:
+    """perf stat of the wasm consumer with a producer minus an idle run of
+    the same length, per event"""
+    cmdline = pin_runtime([WASM_BPF, str(ASSETS_DIR/"uprobe.wasm"), "-d", str(SWEEP_SECONDS)])
+    victim = Popen(pin_producer([ASSETS_DIR/"target", *producer_args()]), cwd=ASSETS_DIR,
+                   text=True, stdout=PIPE)
+    full, lines = perf_stat(cmdline)
+    victim.send_signal(signal.SIGINT)
+    victim.communicate()
+    base, _ = perf_stat(cmdline)
+    # elapsed events ... on the last line
+    events = float(lines[-1].split()[1])
+    return with_ipc(differential(full, base, events))
+
+
+def run_pmu():
+    build_assets()
+    result = {
+        "environment": environment(),
+        "native": pmu_statistics(repeat(lambda _: native_pmu(), PMU_RUN_COUNT)),
+        "wasm_perf_stat": pmu_statistics(repeat(lambda _: wasm_pmu(), PMU_RUN_COUNT)),
+    }
+    print(result)
+    import json
+    with open("result_pmu.json", "w") as f:
+        json.dump(result, f)
+    record_history("ringbuf_benchmark", "result_pmu.json", result)
+
+
+OVERHEAD_RUN_COUNT = 5
+TRACEE_SECONDS = 3
+TRACEE_PERCENTILES = ["p50", "p90", "p99", "p999", "p9999", "max"]
+
+
+def parse_tracee(lines: List[str]) -> Dict[str, float]:
+    """The achieved rate and the latency line of ./target -L"""
+    result = {}
+    for line in lines:
+        if line.startswith("producer threads"):
+            result["calls_per_sec"] = float(line.split()[-1])
+        elif line.startswith("latency ns "):
+            fields = line.split()[2:]
+            result.update({name: float(value) for name, value in zip(fields[::2], fields[1::2])})
+    return result
+
+
+def run_tracee(consumer: Union[List[str], None]) -> Dict[str, float]:
+    """Run one ./target thread calling uprobe_add flat out, alone or once the
+    consumer attached its uprobe, and return what it measured"""
+    proc = None
+    if consumer:
+        consumer = pin_runtime(consumer)
+        print(consumer)
+        proc = Popen(consumer, text=True, stdout=PIPE, stderr=PIPE, cwd=ASSETS_DIR)
+        for line in proc.stdout:
+            if line.startswith("Load and attach"):
+                break
+    tracee = pin_producer([ASSETS_DIR/"target", "-L", "-d", str(TRACEE_SECONDS), *producer_args()])
+    print(tracee)
+    lines = Popen(tracee, text=True, stdout=PIPE, cwd=ASSETS_DIR).communicate()[0].splitlines()
+    if proc:
+        proc.communicate()
+    print(lines)
+    return parse_tracee(lines)
+
+
+def tracee_statistics(samples: List[Dict[str, float]], baseline_ns: float):
+    """baseline_ns is the mean time per call without a probe"""
+    ns_per_call = [1e9 / s["calls_per_sec"] for s in samples]
+    result = {
+        "calls_per_sec": generate_statistics([s["calls_per_sec"] for s in samples], "higher"),
+        "ns_per_call": generate_statistics(ns_per_call, "lower"),
+        "overhead_ns_per_call": generate_statistics([x - baseline_ns for x in ns_per_call], "lower"),
+    }
+    for name in TRACEE_PERCENTILES:
+        result[f"latency_{name}_ns"] = generate_statistics([s[name] for s in samples], "lower")
+    return result
+
+
+def run_overhead():
+    """Slowdown of the traced process: uprobe_add calls per second and per
+    call latency without a probe, with the uprobe and ring buffer submit
+    loaded natively and with the same loaded by wasm-bpf"""
+    build_assets()
+    # the consumers outlive the tracee, which starts after they attached
+    consumer_args = ["-d", str(TRACEE_SECONDS + 2)]
+    configs = {
+        "no_probe": None,
+        "native": [str(ASSETS_DIR/"uprobe"), "-p", "0", *consumer_args],
+        "wasm": [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm"), *consumer_args],
+    }
+    samples = {name: repeat(lambda _: run_tracee(consumer), OVERHEAD_RUN_COUNT)
+               for name, consumer in configs.items()}
+    baseline_ns = sum(1e9 / s["calls_per_sec"] for s in samples["no_probe"]) / OVERHEAD_RUN_COUNT
+    result = {"environment": environment()}
+    for name in configs:
+        result[name] = tracee_statistics(samples[name], baseline_ns)
+    print(result)
+    import json
+    with open("result_overhead.json", "w") as f:
+        json.dump(result, f)
+    record_history("ringbuf_benchmark", "result_overhead.json", result)
+
+
+def main():
+    if not os.path.exists(WORK_DIR/"result"):
+        os.mkdir(WORK_DIR/"result")
+    build_assets()
+    native = [str(ASSETS_DIR/"uprobe"), *producer_args()]
+    # no warmup for the runs under perf, they only feed the flame graphs
+    native_result_with_perf = repeat(lambda i: run_simple(
+        native, WORK_DIR/"result"/f"native{i}.perf", False), 10, 0)
+    native_result_without_perf = repeat(lambda _: run_simple(native), 10)
+    wasm_result_with_perf = repeat(lambda i: run_simple(
+        [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm")], WORK_DIR/"result"/f"wasm{i}.perf", True), 10, 0)
+    wasm_result_without_perf = repeat(lambda _: run_simple(
+        [WASM_BPF, str(ASSETS_DIR/"uprobe.wasm")], None, True), 10)
+    # the native binary with its ring buffer in shared memory and the probe
+    # patched into ./target; it must not fork the producers itself
+    bpftime_result = repeat(lambda _: run_simple(
+        bpftime_load([str(ASSETS_DIR/"uprobe"), "-p", "0"]), None, True, bpftime=True), 10)
+    docker_result = repeat(lambda _: run_simple(
+        ["docker", "run", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE], None), 10)
+    # run_simple returns nanoseconds per event
     result = {
-        "native_perf": generate_statistics(native_result_with_perf),
-        "native_no_perf": generate_statistics(native_result_without_perf),
-        "wasm_perf": generate_statistics(wasm_result_with_perf),
-        "wasm_no_perf": generate_statistics(wasm_result_without_perf),
-        "docker": generate_statistics(docker_result)
+        "environment": environment(),
+        "native_perf": generate_statistics(native_result_with_perf, "lower"),
+        "native_no_perf": generate_statistics(native_result_without_perf, "lower"),
+        "wasm_perf": generate_statistics(wasm_result_with_perf, "lower"),
+        "wasm_no_perf": generate_statistics(wasm_result_without_perf, "lower"),
+        "bpftime_no_perf": generate_statistics(bpftime_result, "lower"),
+        "docker": generate_statistics(docker_result, "lower"),
+        # wasm minus native samples per run in result/diff.svg, by bucket
+        "overhead_buckets": flamegraph_diff(WORK_DIR/"result"),
     }
     print(result)
     import json
     with open("result.json", "w") as f:
         json.dump(result, f)
+    record_history("ringbuf_benchmark", "result.json", result)
 
 
 if __name__ == "__main__":
-    main()
+    if len(sys.argv) > 1 and sys.argv[1] == "sweep":
+        run_sweep()
+    elif len(sys.argv) > 1 and sys.argv[1] == "latency":
+        run_latency()
+    elif len(sys.argv) > 1 and sys.argv[1] == "transport":
+        run_transport()
+    elif len(sys.argv) > 1 and sys.argv[1] == "pmu":
+        run_pmu()
+    elif len(sys.argv) > 1 and sys.argv[1] == "overhead":
+        run_overhead()
+    else:
+        main()
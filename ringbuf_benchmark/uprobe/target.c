@@ -1,19 +1,259 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
-int uprobe_add(int a, int b) { return a + b; }
 
-int main() {
-  srand(time(NULL));
-  while (1) {
-    int a = rand() & 255;
-    int b = rand() & 255;
-    int c = uprobe_add(a, b);
-    assert(a + b == c);
-    // usleep(1); 
+#include "cycle_clock.h"
+#include "latency_hist.h"
+
+#define MAX_THREADS 256
+/* how many calls a thread may issue back to back when it is behind */
+#define BUCKET_BURST 64
+/* sleep instead of spinning when the bucket is this far from a token */
+#define SPIN_LIMIT_NS 50000
+
+/* the probed function, kept out of line so every call hits the uprobe */
+__attribute__((noinline)) int uprobe_add(int a, int b) {
+  asm volatile("" ::: "memory");
+  return a + b;
+}
+
+static struct env {
+  int threads;
+  int first_cpu;
+  int index;
+  double rate;
+  int duration;
+  bool latency;
+} env = {
+    .threads = 1,
+};
+
+const char argp_program_doc[] =
+    "Event producer for the ringbuf benchmark: calls uprobe_add in a loop.\n"
+    "\n"
+    "USAGE: target [-t THREADS] [-r RATE] [-c FIRST_CPU] [-i INDEX] [-d SEC]\n"
+    "              [-L]\n"
+    "\n"
+    "  -t  producer threads, pinned to FIRST_CPU + INDEX * THREADS,\n"
+    "      FIRST_CPU + INDEX * THREADS + 1, ...\n"
+    "  -i  index of this process among several producers, so they do not\n"
+    "      share CPUs; 0 by default\n"
+    "  -r  target calls per second over all threads, 0 for as fast as\n"
+    "      possible\n"
+    "  -d  stop after SEC seconds, otherwise run until SIGINT or SIGTERM\n"
+    "  -L  time every uprobe_add call and print the latency percentiles\n"
+    "\n"
+    "On exit it prints the achieved rate:\n"
+    "  producer threads <n> calls <n> elapsed_ns <n> rate <calls per sec>\n"
+    "and with -L:\n"
+    "  latency clock <clock> overhead <ns>\n"
+    "  latency ns p50 <n> p90 <n> p99 <n> p999 <n> p9999 <n> max <n>\n";
+
+struct producer {
+  pthread_t thread;
+  int id;
+  uint32_t rng;
+  uint64_t calls;
+  int64_t sum;
+  struct latency_hist *hist;
+} __attribute__((aligned(64)));
+
+static struct producer producers[MAX_THREADS];
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig) { exiting = 1; }
+
+static uint64_t get_ktime_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+struct token_bucket {
+  double tokens;
+  double tokens_per_ns;
+  uint64_t last_ns;
+};
+
+/* block until one token is available; only reads the clock when the bucket
+ * runs dry, so an unlimited or fast producer pays for it once per burst */
+static inline void bucket_take(struct token_bucket *tb) {
+  while (tb->tokens < 1.0) {
+    uint64_t now = get_ktime_ns();
+
+    tb->tokens += (now - tb->last_ns) * tb->tokens_per_ns;
+    if (tb->tokens > BUCKET_BURST)
+      tb->tokens = BUCKET_BURST;
+    tb->last_ns = now;
+    if (tb->tokens < 1.0) {
+      double wait_ns = (1.0 - tb->tokens) / tb->tokens_per_ns;
+
+      if (wait_ns > SPIN_LIMIT_NS) {
+        struct timespec ts = {0, (long)wait_ns};
+        nanosleep(&ts, NULL);
+      }
+    }
+  }
+  tb->tokens -= 1.0;
+}
+
+static void pin_to_cpu(int cpu) {
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(ncpus > 0 ? cpu % ncpus : cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    fprintf(stderr, "failed to pin producer to cpu %d\n", cpu);
+}
+
+static void *producer_main(void *arg) {
+  struct producer *p = arg;
+  struct token_bucket tb = {
+      .tokens = 1.0,
+      .tokens_per_ns = env.rate / env.threads / 1e9,
+      .last_ns = get_ktime_ns(),
+  };
+  uint64_t calls = 0;
+  int64_t sum = 0;
+
+  pin_to_cpu(env.first_cpu + env.index * env.threads + p->id);
+  while (!exiting) {
+    uint32_t r = xorshift32(&p->rng);
+    int a = r & 255;
+    int b = (r >> 8) & 255;
+
+    if (env.rate > 0)
+      bucket_take(&tb);
+    if (p->hist) {
+      uint64_t t0 = cycle_clock_now();
+
+      sum += uprobe_add(a, b);
+      hist_record(p->hist, cycle_clock_now() - t0);
+    } else {
+      sum += uprobe_add(a, b);
+    }
+    calls++;
+  }
+  p->calls = calls;
+  p->sum = sum;
+  return NULL;
+}
+
+static int parse_args(int argc, char *argv[]) {
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      printf("%s\n", argp_program_doc);
+      exit(0);
+    }
+    if (strcmp(arg, "-L") == 0) {
+      env.latency = true;
+      continue;
+    }
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return -1;
+    }
+    i++;
+    if (strcmp(arg, "-t") == 0) {
+      env.threads = atoi(val);
+    } else if (strcmp(arg, "-r") == 0) {
+      env.rate = atof(val);
+    } else if (strcmp(arg, "-c") == 0) {
+      env.first_cpu = atoi(val);
+    } else if (strcmp(arg, "-i") == 0) {
+      env.index = atoi(val);
+    } else if (strcmp(arg, "-d") == 0) {
+      env.duration = atoi(val);
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return -1;
+    }
+  }
+  if (env.threads <= 0 || env.threads > MAX_THREADS || env.rate < 0 ||
+      env.index < 0) {
+    fprintf(stderr, "invalid arguments\n");
+    return -1;
+  }
+  return 0;
+}
+
+static struct latency_hist call_hist;
+
+int main(int argc, char *argv[]) {
+  uint64_t start, elapsed, calls = 0;
+  int i, err;
+
+  if (parse_args(argc, argv))
+    return 1;
+  signal(SIGINT, sig_handler);
+  signal(SIGTERM, sig_handler);
+  if (env.latency) {
+    cycle_clock_calibrate();
+    for (i = 0; i < env.threads; i++) {
+      if (!(producers[i].hist = calloc(1, sizeof(*producers[i].hist)))) {
+        fprintf(stderr, "failed to allocate the histogram of producer %d\n",
+                i);
+        return 1;
+      }
+    }
+  }
+
+  start = get_ktime_ns();
+  for (i = 0; i < env.threads; i++) {
+    producers[i].id = i;
+    producers[i].rng = (uint32_t)time(NULL) ^ (2654435761u * (i + 1));
+    err = pthread_create(&producers[i].thread, NULL, producer_main,
+                         &producers[i]);
+    if (err) {
+      fprintf(stderr, "failed to create producer %d: %d\n", i, err);
+      exiting = 1;
+      env.threads = i;
+      break;
+    }
+  }
+  while (!exiting) {
+    sleep(1);
+    if (env.duration && get_ktime_ns() - start >= env.duration * 1000000000ULL)
+      exiting = 1;
+  }
+  for (i = 0; i < env.threads; i++) {
+    pthread_join(producers[i].thread, NULL);
+    calls += producers[i].calls;
+  }
+  elapsed = get_ktime_ns() - start;
+  printf("producer threads %d calls %" PRIu64 " elapsed_ns %" PRIu64
+         " rate %.0f\n",
+         env.threads, calls, elapsed, (double)calls * 1e9 / elapsed);
+  if (env.latency) {
+    for (i = 0; i < env.threads; i++) {
+      hist_merge(&call_hist, producers[i].hist);
+      free(producers[i].hist);
+    }
+    hist_print_latency(&call_hist);
   }
+  return 0;
 }
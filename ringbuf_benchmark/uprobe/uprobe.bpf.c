@@ -6,18 +6,96 @@
 #include "uprobe.h"
 char LICENSE[] SEC("license") = "GPL";
 
+/* record size, between sizeof(struct uprobe_event) and MAX_EVENT_SIZE */
+const volatile __u32 event_size = sizeof(struct uprobe_event);
+/* wake the consumer up for every Nth record only, 0 lets the kernel decide */
+const volatile __u32 wakeup_batch = 0;
+/* emit the records through pb instead of rb */
+const volatile __u32 use_perfbuf = 0;
+
 struct {
   __uint(type, BPF_MAP_TYPE_RINGBUF);
-  __uint(max_entries, 256 * 1024);
+  __uint(max_entries, RINGBUF_SIZE);
 } rb SEC(".maps");
 
+struct {
+  __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+  __uint(key_size, sizeof(__u32));
+  __uint(value_size, sizeof(__u32));
+} pb SEC(".maps");
+
+/* perf buffer records are copied out of this scratch space */
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __uint(key_size, sizeof(__u32));
+  __uint(value_size, MAX_EVENT_SIZE);
+} heap SEC(".maps");
+
+/* failed reserves or outputs, i.e. events dropped because the buffer was full */
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, __u32);
+  __type(value, __u64);
+} drops SEC(".maps");
+
+/* records submitted on this CPU, to pick the ones that wake the consumer */
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, __u32);
+  __type(value, __u64);
+} batch SEC(".maps");
+
+static __always_inline __u64 submit_flags(void) {
+  __u32 zero = 0;
+  __u64 *cnt;
+
+  if (!wakeup_batch)
+    return 0;
+  cnt = bpf_map_lookup_elem(&batch, &zero);
+  if (!cnt)
+    return 0;
+  return ++*cnt % wakeup_batch ? BPF_RB_NO_WAKEUP : BPF_RB_FORCE_WAKEUP;
+}
+
+static __always_inline void count_drop(void) {
+  __u32 zero = 0;
+  __u64 *cnt = bpf_map_lookup_elem(&drops, &zero);
+
+  if (cnt)
+    __sync_fetch_and_add(cnt, 1);
+}
+
+static __always_inline int output_perfbuf(void *ctx, int a, int b) {
+  __u32 zero = 0;
+  struct uprobe_event *e = bpf_map_lookup_elem(&heap, &zero);
+
+  if (!e)
+    return 0;
+  e->a = a;
+  e->b = b;
+  e->ts = bpf_ktime_get_ns();
+  if (bpf_perf_event_output(ctx, &pb, BPF_F_CURRENT_CPU, e, event_size))
+    count_drop();
+  return 0;
+}
+
 SEC("uprobe/./target:uprobe_add")
 int BPF_KPROBE(uprobe_add, int a, int b) {
-  struct uprobe_event *e = bpf_ringbuf_reserve(&rb, sizeof(struct uprobe_event), 0);
-  if (!e)
+  struct uprobe_event *e;
+
+  if (use_perfbuf)
+    return output_perfbuf(ctx, a, b);
+  e = bpf_ringbuf_reserve(&rb, event_size, 0);
+  if (!e) {
+    count_drop();
     return 0;
+  }
   e->a = a;
   e->b = b;
-  bpf_ringbuf_submit(e, 0);
+  e->ts = bpf_ktime_get_ns();
+  bpf_ringbuf_submit(e, submit_flags());
   return 0;
 }
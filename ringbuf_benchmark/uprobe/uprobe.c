@@ -5,50 +5,336 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #ifndef NATIVE_LIBBPF
 #include "libbpf-wasm.h"
 #else
 #include <signal.h>
+#include <sys/wait.h>
 #endif
+#include "latency_hist.h"
+#include "pmu_counters.h"
+#include "uprobe.h"
 #include "uprobe.skel.h"
 
 #define NANO_SECOND_TO_RUN ((uint64_t)1000 * 1000 * 1000 * 3)
 
+#define MAX_PRODUCERS 64
+
+/* -l checks before measuring that the guest clock has the origin of
+ * bpf_ktime_get_ns(): it samples records for CLOCK_CHECK_NS, waiting up to
+ * CLOCK_WAIT_NS for the first, and refuses to measure if the smallest
+ * difference between arrival and stamp is more than CLOCK_OFFSET_MAX_NS off
+ * zero; the closest record only waited for the poll to return */
+#define CLOCK_CHECK_NS ((uint64_t)200 * 1000 * 1000)
+#define CLOCK_WAIT_NS ((uint64_t)5 * 1000 * 1000 * 1000)
+#define CLOCK_OFFSET_MAX_NS ((int64_t)50 * 1000 * 1000)
+
+static struct env {
+  uint32_t event_size;
+  uint32_t ringbuf_size;
+  int producers;
+  const char *producer_threads;
+  const char *producer_rate;
+  const char *producer_cpu;
+  uint64_t duration_ns;
+  bool busy_poll;
+  uint32_t wakeup_batch;
+  bool latency;
+  bool perfbuf;
+  int perf_pages;
+  bool counters;
+} env = {
+    .event_size = sizeof(struct uprobe_event),
+    .producers = 1,
+    .producer_threads = "1",
+    .producer_rate = "0",
+    .producer_cpu = "0",
+    .duration_ns = NANO_SECOND_TO_RUN,
+    .perf_pages = PERF_BUFFER_PAGES,
+};
+
+const char argp_program_doc[] =
+    "Count how many ring buffer events can be consumed per second.\n"
+    "\n"
+    "USAGE: uprobe [-s EVENT_SIZE] [-b RINGBUF_SIZE] [-p PRODUCERS] [-t THREADS]\n"
+    "              [-r RATE] [-c FIRST_CPU] [-d SEC] [-m poll|busy] [-w BATCH] [-l]\n"
+    "              [-T ringbuf|perfbuf] [-P PAGES] [-C]\n"
+    "\n"
+    "  -s  record size in bytes, 16 to 4096\n"
+    "  -b  ring buffer size in bytes, a power of two multiple of the page\n"
+    "      size (native only, rebuild with make RINGBUF_SIZE=... for wasm)\n"
+    "  -p  number of ./target processes to fork (native only, start them\n"
+    "      yourself for wasm); 0 to rely on external producers\n"
+    "  -t  producer threads in each ./target\n"
+    "  -r  calls per second each ./target is limited to, 0 for no limit\n"
+    "  -c  first CPU the ./target threads are pinned to, each ./target\n"
+    "      takes the next THREADS CPUs\n"
+    "  -d  seconds to consume events for\n"
+    "  -m  wait for events in poll (default) or spin on the consume call\n"
+    "  -w  wake the consumer for every BATCH-th record only\n"
+    "  -l  measure the latency from submitting a record to the callback\n"
+    "  -T  transport the records through a ring buffer or a perf event array\n"
+    "  -P  perf buffer pages per CPU (native only)\n"
+    "  -C  count cpu events of the consumer, printed per event (native)\n";
+
 static uint64_t count = 0;
+static struct latency_hist hist;
+/* records seen by check_clock(), and the smallest arrival minus stamp */
+static bool clock_check = false;
+static uint64_t clock_samples = 0;
+static int64_t clock_offset = INT64_MAX;
+/* events stamped later than they were received, the clocks disagree */
+static uint64_t skewed = 0;
+/* records older than one delivered before them, and by how much */
+static uint64_t last_ts = 0;
+static uint64_t inversions = 0;
+static uint64_t max_backward = 0;
+
+static uint64_t get_monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 static int handle_event(void *ctx, void *data, size_t data_sz) {
+  const struct uprobe_event *e = data;
+
+  if (clock_check) {
+    int64_t offset = (int64_t)(get_monotonic() - e->ts);
+
+    clock_samples++;
+    if (offset < clock_offset)
+      clock_offset = offset;
+    return 0;
+  }
   count++;
+  if (e->ts < last_ts) {
+    inversions++;
+    if (last_ts - e->ts > max_backward)
+      max_backward = last_ts - e->ts;
+  } else {
+    last_ts = e->ts;
+  }
+  if (env.latency) {
+    uint64_t now = get_monotonic();
+
+    if (now >= e->ts)
+      hist_record(&hist, now - e->ts);
+    else
+      skewed++;
+  }
   return 0;
 }
 
+#ifdef NATIVE_LIBBPF
+static void handle_perf_event(void *ctx, int cpu, void *data, uint32_t size) {
+  handle_event(ctx, data, size);
+}
+
+/* drops are counted on the bpf side for both transports */
+static void lost_event(void *ctx, int cpu, unsigned long long cnt) {}
+#endif
+
 static uint64_t get_timestamp() {
   struct timespec ts;
   clock_gettime(CLOCK_REALTIME, &ts);
   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
+static uint64_t get_cpu_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int parse_args(int argc, char *argv[]) {
+  // parse the args manually for demo purpose
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      printf("%s\n", argp_program_doc);
+      exit(0);
+    }
+    if (strcmp(arg, "-l") == 0) {
+      env.latency = true;
+      continue;
+    }
+    if (strcmp(arg, "-C") == 0) {
+      env.counters = true;
+      continue;
+    }
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return -1;
+    }
+    i++;
+    if (strcmp(arg, "-s") == 0) {
+      env.event_size = strtoul(val, NULL, 10);
+    } else if (strcmp(arg, "-b") == 0) {
+      env.ringbuf_size = strtoul(val, NULL, 10);
+    } else if (strcmp(arg, "-p") == 0) {
+      env.producers = atoi(val);
+    } else if (strcmp(arg, "-t") == 0) {
+      env.producer_threads = val;
+    } else if (strcmp(arg, "-r") == 0) {
+      env.producer_rate = val;
+    } else if (strcmp(arg, "-c") == 0) {
+      env.producer_cpu = val;
+    } else if (strcmp(arg, "-d") == 0) {
+      env.duration_ns = strtoull(val, NULL, 10) * 1000000000ULL;
+    } else if (strcmp(arg, "-m") == 0) {
+      env.busy_poll = strcmp(val, "busy") == 0;
+    } else if (strcmp(arg, "-w") == 0) {
+      env.wakeup_batch = strtoul(val, NULL, 10);
+    } else if (strcmp(arg, "-T") == 0) {
+      env.perfbuf = strcmp(val, "perfbuf") == 0;
+    } else if (strcmp(arg, "-P") == 0) {
+      env.perf_pages = atoi(val);
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return -1;
+    }
+  }
+  if (env.event_size < sizeof(struct uprobe_event) ||
+      env.event_size > MAX_EVENT_SIZE) {
+    fprintf(stderr, "event size must be between %zu and %d\n",
+            sizeof(struct uprobe_event), MAX_EVENT_SIZE);
+    return -1;
+  }
+  /* perf_buffer__new wants a power of two */
+  if (env.perf_pages <= 0 || (env.perf_pages & (env.perf_pages - 1))) {
+    fprintf(stderr, "perf buffer pages must be a power of two\n");
+    return -1;
+  }
+  if (env.producers < 0 || env.producers > MAX_PRODUCERS) {
+    fprintf(stderr, "at most %d producers\n", MAX_PRODUCERS);
+    return -1;
+  }
+  return 0;
+}
+
+#ifdef NATIVE_LIBBPF
+static int poll_buffer(struct ring_buffer *rb, struct perf_buffer *pb) {
+  if (pb && env.busy_poll)
+    return perf_buffer__consume(pb);
+  if (pb)
+    return perf_buffer__poll(pb, 1);
+  if (env.busy_poll)
+    return ring_buffer__consume(rb);
+  return ring_buffer__poll(rb, 1);
+}
+#else
+static int poll_buffer(struct bpf_buffer *rb, void *pb) {
+  if (env.busy_poll)
+    return bpf_buffer__consume(rb);
+  return bpf_buffer__poll(rb, 1 /* timeout, ms */);
+}
+#endif
+
+/* Compare the stamps of live records with the guest clock before the
+ * latencies are measured. A clock with another origin only shows up as
+ * records from the future when it is behind the kernel; ahead, it would
+ * inflate every latency by the offset. */
+static int check_clock(void *rb, void *pb) {
+  uint64_t start = get_monotonic(), first = 0;
+
+  clock_check = true;
+  while (true) {
+    poll_buffer(rb, pb);
+    if (clock_samples && !first)
+      first = get_monotonic();
+    if (first ? get_monotonic() - first >= CLOCK_CHECK_NS
+              : get_monotonic() - start >= CLOCK_WAIT_NS)
+      break;
+  }
+  clock_check = false;
+  if (!clock_samples) {
+    fprintf(stderr, "no records within %" PRIu64 " s to check the clock "
+                    "against, start the producers\n",
+            CLOCK_WAIT_NS / 1000000000);
+    return -1;
+  }
+  if (clock_offset > CLOCK_OFFSET_MAX_NS || clock_offset < -CLOCK_OFFSET_MAX_NS) {
+    fprintf(stderr, "CLOCK_MONOTONIC is %" PRId64 " ns off the kernel clock "
+                    "over %" PRIu64 " records, not measuring latencies\n",
+            clock_offset, clock_samples);
+    return -1;
+  }
+  return 0;
+}
+
+static uint64_t read_drops(struct uprobe_bpf *skel) {
+  uint32_t zero = 0;
+  uint64_t drops = 0;
+
+  bpf_map_lookup_elem(bpf_map__fd(skel->maps.drops), &zero, &drops);
+  return drops;
+}
+
 int main(int argc, char *argv[]) {
   struct uprobe_bpf *skel = NULL;
+#ifdef NATIVE_LIBBPF
+  struct ring_buffer *rb = NULL;
+  struct perf_buffer *pb = NULL;
+#else
+  struct bpf_buffer *rb = NULL;
+  /* one buffer object for both transports */
+  void *pb = NULL;
+#endif
   int err;
 
+  if (parse_args(argc, argv))
+    return 1;
+
 #ifdef NATIVE_LIBBPF
-  int child_pid = fork();
-  if (child_pid < 0) {
-    err = child_pid;
-    printf("Unable to fork");
-    goto cleanup;
-  }
+  int child_pids[MAX_PRODUCERS] = {};
+  for (int i = 0; i < env.producers; i++) {
+    int child_pid = fork();
+    if (child_pid < 0) {
+      err = child_pid;
+      printf("Unable to fork");
+      goto cleanup;
+    }
 
-  if (child_pid == 0) {
-    execl("./target", "./target", NULL);
+    if (child_pid == 0) {
+      char index[16];
+
+      /* keep the producer reports out of the lines run.py parses */
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+      snprintf(index, sizeof(index), "%d", i);
+      execl("./target", "./target", "-t", env.producer_threads, "-r",
+            env.producer_rate, "-c", env.producer_cpu, "-i", index, NULL);
+      exit(1);
+    }
+    child_pids[i] = child_pid;
   }
 #endif
 
-  skel = uprobe_bpf__open_and_load();
+  skel = uprobe_bpf__open();
   if (!skel) {
-    printf("Failed to open and load BPF skeleton\n");
+    printf("Failed to open BPF skeleton\n");
+    err = -1;
+    goto cleanup;
+  }
+  skel->rodata->event_size = env.event_size;
+  skel->rodata->wakeup_batch = env.wakeup_batch;
+  skel->rodata->use_perfbuf = env.perfbuf;
+#ifdef NATIVE_LIBBPF
+  if (env.ringbuf_size)
+    bpf_map__set_max_entries(skel->maps.rb, env.ringbuf_size);
+#else
+  if (env.ringbuf_size && env.ringbuf_size != RINGBUF_SIZE)
+    fprintf(stderr, "ignoring -b, this build uses a %d byte ring buffer\n",
+            RINGBUF_SIZE);
+#endif
+  err = uprobe_bpf__load(skel);
+  if (err) {
+    printf("Failed to load BPF skeleton\n");
     err = -1;
     goto cleanup;
   }
@@ -61,42 +347,115 @@ int main(int argc, char *argv[]) {
   }
 
   printf("Load and attach BPF uprobe successfully\n");
+  /* run.py waits for this line before it starts producers under bpftime */
+  fflush(stdout);
 
 #ifdef NATIVE_LIBBPF
-  struct ring_buffer *rb =
-      ring_buffer__new(bpf_map__fd(skel->maps.rb), handle_event, NULL, NULL);
+  if (env.perfbuf)
+    pb = perf_buffer__new(bpf_map__fd(skel->maps.pb), env.perf_pages,
+                          handle_perf_event, lost_event, NULL, NULL);
+  else
+    rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), handle_event, NULL,
+                          NULL);
+  if (!rb && !pb) {
 #else
-  struct bpf_buffer *rb = bpf_buffer__open(skel->maps.rb, handle_event, NULL);
-#endif
+  /* the runtime picks the buffer type from the map */
+  rb = bpf_buffer__open(env.perfbuf ? skel->maps.pb : skel->maps.rb,
+                        handle_event, NULL);
   if (!rb) {
+#endif
     err = -1;
     fprintf(stderr, "Failed to create ring buffer\n");
     goto cleanup;
   }
+  if (env.latency && check_clock(rb, pb)) {
+    err = -1;
+    goto cleanup;
+  }
+  hist_reset(&hist);
+  /* opened after forking the producers, so only the consumer is counted */
+  struct pmu_counters pmu;
+  if (env.counters) {
+    pmu_open(&pmu);
+    pmu_start(&pmu);
+  }
+  uint64_t drops_before = read_drops(skel);
+  uint64_t start_cpu = get_cpu_time();
   uint64_t start_time = get_timestamp();
-  //   printf("%lu, %lu\n",start_time,get_timestamp_quick());
-  // while (get_timestamp() - start_time < NANO_SECOND_TO_RUN)
-  for (int i = 1; i <= 1000000; i++) {
-#ifdef NATIVE_LIBBPF
-    err = ring_buffer__poll(rb, 1);
-#else
-    err = bpf_buffer__poll(rb, 1 /* timeout, ms */);
-#endif
+  uint64_t total_time = 0;
+  while (total_time < env.duration_ns) {
+    err = poll_buffer(rb, pb);
+    total_time = get_timestamp() - start_time;
   }
-  uint64_t total_time = get_timestamp() - start_time;
+  uint64_t cpu_time = get_cpu_time() - start_cpu;
+  if (env.counters)
+    pmu_stop(&pmu);
+  uint64_t drops = read_drops(skel) - drops_before;
+  uint64_t bytes = count * env.event_size;
   printf("Total nanoseconds: %" PRIu64 ", total polled events: %" PRIu64
          ", events per millisecond: %f\n",
          total_time, count, (double)count / (((double)total_time) / 1000000));
-  printf("%" PRIu64 " %" PRIu64, total_time, count);
+  printf("event size: %" PRIu32 ", bytes per second: %f, dropped events: %" PRIu64
+         ", consumer cpu: %f%%\n",
+         env.event_size, (double)bytes * 1e9 / total_time, drops,
+         (double)cpu_time * 100 / total_time);
+  printf("transport %s, ordering inversions: %" PRIu64
+         ", max backward step ns: %" PRIu64 "\n",
+         env.perfbuf ? "perfbuf" : "ringbuf", inversions, max_backward);
+#ifdef NATIVE_LIBBPF
+  if (env.perfbuf)
+    printf("buffer memory: %d cpus x %d pages = %ld bytes\n",
+           libbpf_num_possible_cpus(), env.perf_pages + 1,
+           (long)libbpf_num_possible_cpus() * (env.perf_pages + 1) *
+               sysconf(_SC_PAGESIZE));
+  else
+    printf("buffer memory: %" PRIu32 " bytes\n",
+           env.ringbuf_size ? env.ringbuf_size : RINGBUF_SIZE);
+#endif
+  if (env.counters) {
+    pmu_print(&pmu, count);
+    pmu_close(&pmu);
+  }
+  uint64_t p50 = hist_percentile(&hist, 50);
+  uint64_t p99 = hist_percentile(&hist, 99);
+  uint64_t p999 = hist_percentile(&hist, 99.9);
+  if (env.latency)
+    printf("%s poll, wakeup batch %" PRIu32 ", latency ns p50: %" PRIu64
+           ", p99: %" PRIu64 ", p999: %" PRIu64 ", max: %" PRIu64
+           ", skewed: %" PRIu64 "\n",
+           env.busy_poll ? "busy" : "blocking", env.wakeup_batch, p50, p99,
+           p999, hist.max, skewed);
+  /* elapsed events bytes drops cpu p50 p99 p999 max inversions backward
+   * skewed, parsed by run.py; the latencies are 0 without -l */
+  printf("%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+         " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+         " %" PRIu64 " %" PRIu64,
+         total_time, count, bytes, drops, cpu_time, p50, p99, p999, hist.max,
+         inversions, max_backward, skewed);
+  err = 0;
+  /* the guest clock is not the one bpf_ktime_get_ns() reads, the
+   * latencies mean nothing */
+  if (skewed) {
+    fprintf(stderr, "\n%" PRIu64 " records stamped after they arrived, "
+                    "CLOCK_MONOTONIC is not the kernel clock\n",
+            skewed);
+    err = -1;
+  }
 
 cleanup:
 
 #ifdef NATIVE_LIBBPF
-  if (child_pid > 0)
-    kill(child_pid, SIGTERM);
+  for (int i = 0; i < env.producers; i++)
+    if (child_pids[i] > 0)
+      kill(child_pids[i], SIGTERM);
+  for (int i = 0; i < env.producers; i++)
+    if (child_pids[i] > 0)
+      waitpid(child_pids[i], NULL, 0);
   ring_buffer__free(rb);
+  perf_buffer__free(pb);
 #else
-  bpf_buffer__free(rb);
+  if (rb)
+    bpf_buffer__free(rb);
 #endif
   uprobe_bpf__destroy(skel);
   return err < 0 ? -err : 0;
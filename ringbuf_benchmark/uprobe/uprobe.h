@@ -1,7 +1,22 @@
 #ifndef _UPROBE_H
 #define _UPROBE_H
 
+/* upper bound of the record size, also the size of the event buffer the wasm
+ * sdk hands to the runtime in bpf_buffer__poll */
+#define MAX_EVENT_SIZE 4096
+
+/* the wasm sdk can not resize maps before load, so the wasm build picks the
+ * ring buffer size at compile time: make RINGBUF_SIZE=... */
+#ifndef RINGBUF_SIZE
+#define RINGBUF_SIZE (256 * 1024)
+#endif
+
+/* pages per CPU of the perf buffer, the wasm-bpf runtime uses the same */
+#define PERF_BUFFER_PAGES 64
+
 struct uprobe_event {
+  /* bpf_ktime_get_ns() right before submit, CLOCK_MONOTONIC in userspace */
+  unsigned long long ts;
   int a;
   int b;
 } __attribute__((packed));
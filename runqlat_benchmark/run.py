@@ -0,0 +1,147 @@
+import json
+import pathlib
+import shutil
+import os
+import subprocess
+import time
+import signal
+import sys
+from typing import Dict, List, Tuple, Union
+WORK_DIR = pathlib.Path(__file__).parent
+PROJECT_ROOT = WORK_DIR.parent
+sys.path.insert(0, str(PROJECT_ROOT))
+from harness import generate_statistics, repeat, pin_runtime, environment, record_history  # noqa: E402
+from harness.pmu import PERF  # noqa: E402
+ASSETS_DIR = WORK_DIR/"assets"
+WASM_BPF = PROJECT_ROOT/"assets"/"wasm-bpf"
+BPFTOOL = os.environ.get("BPFTOOL", "bpftool")
+BPF_STATS = "/proc/sys/kernel/bpf_stats_enabled"
+RUN_COUNT = 5
+# seconds to wait after starting runqlat, so it has loaded and attached
+SETTLE_SECONDS = 3
+# hackbench: groups of 20 senders and 20 receivers passing messages over
+# sockets, enough context switches to keep every CPU in sched_switch
+LOAD_GROUPS = max(1, (os.cpu_count() or 1) // 4)
+LOAD_LOOPS = 2000
+RUNTIMES = ["native", "wasm"]
+# build and arguments of each mode: shared and percpu keep the wakeup times
+# in task storage, start_hash in the start hash map like before; loglinear
+# is shared with the log-linear histogram of the LOGLINEAR=1 build
+MODES = {
+    "shared": ("runqlat", []),
+    "percpu": ("runqlat", ["--percpu"]),
+    "start_hash": ("runqlat", ["--no-task-storage"]),
+    "loglinear": ("runqlat-loglinear", []),
+}
+BUILDS = {"runqlat": "", "runqlat-loglinear": "LOGLINEAR=1"}
+PROGRAMS = ["sched_switch", "sched_wakeup", "sched_wakeup_new"]
+
+
+def build_assets():
+    if not os.path.exists(ASSETS_DIR):
+        os.makedirs(ASSETS_DIR)
+        root = PROJECT_ROOT/"examples"/"runqlat"
+        for build, make_args in BUILDS.items():
+            os.system(f"cd {root} && make clean && make -j {make_args}")
+            shutil.copy(root/"runqlat.wasm", ASSETS_DIR/f"{build}.wasm")
+            os.system(f"cd {root} && make clean")
+            os.system(f"cd {root} && make -f Makefile.native clean && make -f Makefile.native -j {make_args}")
+            shutil.copy(root/"runqlat", ASSETS_DIR/build)
+
+
+def prog_ids(pid: int) -> List[int]:
+    """ids of the bpf programs the process holds open, from their fdinfo"""
+    ids = []
+    for fd in os.listdir(f"/proc/{pid}/fdinfo"):
+        try:
+            with open(f"/proc/{pid}/fdinfo/{fd}") as f:
+                info = dict(line.split(":", 1) for line in f if ":" in line)
+        except OSError:
+            continue
+        if "prog_id" in info:
+            ids.append(int(info["prog_id"]))
+    return ids
+
+
+def prog_stats(ids: List[int]) -> Dict[str, Tuple[int, int]]:
+    """run_time_ns and run_cnt by program name, cut to the 15 characters the
+    kernel keeps; it only counts them while kernel.bpf_stats_enabled is set"""
+    result = {}
+    for prog_id in ids:
+        info = json.loads(subprocess.check_output([BPFTOOL, "prog", "show", "id", str(prog_id), "--json"]))
+        result[info["name"][:15]] = (info.get("run_time_ns", 0), info.get("run_cnt", 0))
+    return result
+
+
+def run_load() -> float:
+    """Seconds perf bench sched messaging took"""
+    out = subprocess.check_output(
+        [PERF, "bench", "sched", "messaging", "-g", str(LOAD_GROUPS), "-l", str(LOAD_LOOPS)], text=True)
+    for line in out.splitlines():
+        if line.strip().startswith("Total time:"):
+            return float(line.split()[2])
+    raise ValueError("no total time in the perf bench output")
+
+
+def run_once(runtime: Union[str, None], build: str, args: List[str]) -> Dict[str, float]:
+    """ns per run of each program and the time of the load, with the runqlat
+    build loaded by runtime, or without it if runtime is None"""
+    if runtime is None:
+        return {"load_seconds": run_load()}
+    if runtime == "native":
+        cmd = [str(ASSETS_DIR/build), *args, "3600"]
+    else:
+        cmd = [str(WASM_BPF), str(ASSETS_DIR/f"{build}.wasm"), *args, "3600"]
+    cmd = pin_runtime(cmd)
+    print(cmd)
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, cwd=ASSETS_DIR)
+    time.sleep(SETTLE_SECONDS)
+    try:
+        ids = prog_ids(proc.pid)
+        before = prog_stats(ids)
+        result = {"load_seconds": run_load()}
+        after = prog_stats(ids)
+    finally:
+        proc.send_signal(signal.SIGTERM)
+        proc.wait()
+    for name in PROGRAMS:
+        run_time = after[name[:15]][0] - before[name[:15]][0]
+        runs = after[name[:15]][1] - before[name[:15]][1]
+        result[f"{name}_ns"] = run_time / max(runs, 1)
+        result[f"{name}_runs"] = runs
+    print(runtime, args, result)
+    return result
+
+
+def main():
+    """Cost of the runqlat programs per run in every mode while every CPU
+    context switches"""
+    build_assets()
+    with open(BPF_STATS) as f:
+        stats_enabled = f.read().strip()
+    with open(BPF_STATS, "w") as f:
+        f.write("1")
+    try:
+        result = {"environment": environment()}
+        baseline = repeat(lambda _: run_once(None, "", []), RUN_COUNT)
+        result["no_probe"] = {"load_seconds": generate_statistics([r["load_seconds"] for r in baseline], "lower")}
+        for runtime in RUNTIMES:
+            result[runtime] = {}
+            for mode, (build, args) in MODES.items():
+                runs = repeat(lambda _: run_once(runtime, build, args), RUN_COUNT)
+                result[runtime][mode] = {
+                    key: generate_statistics([run[key] for run in runs],
+                                             None if key.endswith("_runs") else "lower")
+                    for key in runs[0]
+                }
+    finally:
+        with open(BPF_STATS, "w") as f:
+            f.write(stats_enabled)
+    print(result)
+    with open(WORK_DIR/"result.json", "w") as f:
+        json.dump(result, f)
+    record_history("runqlat_benchmark", "result.json", result)
+
+
+if __name__ == "__main__":
+    main()
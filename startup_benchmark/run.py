@@ -4,44 +4,123 @@ import os
 import subprocess
 import time
 import signal
-from typing import List
+import threading
+import sys
+from typing import Dict, List, Tuple, Union
 WORK_DIR = pathlib.Path(__file__).parent
 PROJECT_ROOT = WORK_DIR.parent
+sys.path.insert(0, str(PROJECT_ROOT))
+from harness import generate_statistics, repeat, pin_runtime, environment, record_history  # noqa: E402
 RUN_COUNT = 10
 DOCKER_IMAGE = "6203a9d12082"
+# exec'ed over and over after launch until the tool reports it; bootstrap
+# prints the comm, which the kernel truncates to 15 characters
+MARKER_NAME = "ttfe-marker"
+MARKER_INTERVAL = 0.005
+STORM_SIZES = [1, 2, 4, 8, 16, 32, 64]
+STORM_RUN_COUNT = 5
 
 
-def run_simple_process(cmd: List[str]):
+def read_phases(proc: subprocess.Popen, spawn_ns: int, attach_ns: int) -> Dict[str, float]:
+    """Parse the trailer examples/bootstrap/startup_phases.h prints after
+    "Attach ok!" into seconds per phase. exec is the time from spawning the
+    process to the first mark in main, it includes the wasm instantiation for
+    wasm-bpf and the container setup for docker. It compares the clock of
+    the guest with ours; a WASI runtime may count from its own origin, so
+    exec is left out unless it falls between spawning and "Attach ok!"."""
+    phases = {}
+    while proc.stdout:
+        line = proc.stdout.readline()
+        if not line or line.startswith(b"startup-phases-end"):
+            break
+        fields = line.decode().split()
+        if fields[0] == "startup-clock":
+            if spawn_ns < int(fields[1]) < attach_ns:
+                phases["exec"] = (int(fields[1]) - spawn_ns) / 1e9
+            else:
+                print(f"dropping exec, the clock of main {fields[1]} is not between spawn {spawn_ns} "
+                      f"and attach {attach_ns}")
+        elif fields[0] == "startup-phase":
+            phases[fields[1]] = int(fields[2]) / 1e9
+        else:
+            # binaries built without the phase marks, e.g. an old docker image
+            break
+    return phases
+
+
+def run_simple_process(cmd: List[str]) -> Tuple[float, Dict[str, float]]:
+    # time.monotonic_ns() reads CLOCK_MONOTONIC, the clock the marks use
+    spawn_ns = time.monotonic_ns()
     proc = subprocess.Popen(
-        cmd, bufsize=0, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, shell=False,)
+        pin_runtime(cmd), bufsize=0, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, shell=False,)
     now = time.time()
     while proc.stdout:
         line = proc.stdout.readline()
         if line.startswith(b"Attach ok!"):
             break
     t = time.time()
+    attach_ns = time.monotonic_ns()
     assert line.startswith(b"Attach ok!")
-    print(line, t-now)
+    phases = read_phases(proc, spawn_ns, attach_ns)
+    print(line, t-now, phases)
     proc.send_signal(signal.SIGTERM)
     proc.wait()
-    return t - now
-
-
-def generate_statistics(data: List[float]):
-    sqrsum = sum(x**2 for x in data)
-    avg = sum(data)/len(data)
-    sqr = sqrsum/len(data) - avg**2
-    return {
-        "max": max(data),
-        "min": min(data),
-        "sqr": sqr,
-        "avg": avg,
-        "count": len(data),
-        "raw_data": data
-    }
+    return t - now, phases
 
 
-def run_startup_test():
+def run_first_event(cmd: List[str]) -> Tuple[float, float]:
+    """Time until "Attach ok!" and until the tool prints the first exec of the
+    marker binary, which is started right after launch and then every
+    MARKER_INTERVAL seconds. Attaching early does not help if the tool only
+    starts delivering events later."""
+    marker = WORK_DIR/"assets"/MARKER_NAME
+    stop = threading.Event()
+
+    def exec_marker():
+        while not stop.is_set():
+            subprocess.run([str(marker)])
+            time.sleep(MARKER_INTERVAL)
+
+    proc = subprocess.Popen(
+        pin_runtime(cmd), bufsize=0, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, shell=False,)
+    now = time.time()
+    trigger = threading.Thread(target=exec_marker)
+    trigger.start()
+    attach = None
+    line = b""
+    try:
+        while proc.stdout:
+            line = proc.stdout.readline()
+            if not line:
+                break
+            if attach is None and line.startswith(b"Attach ok!"):
+                attach = time.time() - now
+            if MARKER_NAME.encode() in line:
+                break
+        first_event = time.time() - now
+    finally:
+        stop.set()
+        trigger.join()
+    assert attach is not None and MARKER_NAME.encode() in line
+    print(cmd, attach, first_event)
+    proc.send_signal(signal.SIGTERM)
+    proc.wait()
+    return attach, first_event
+
+
+def phase_statistics(samples: List[Tuple[float, Dict[str, float]]]):
+    """Total time to attach plus one entry per phase seen in the runs"""
+    result = {"total": generate_statistics([total for total, _ in samples], "lower")}
+    names = []
+    for _, phases in samples:
+        names += [name for name in phases if name not in names]
+    for name in names:
+        data = [phases[name] for _, phases in samples if name in phases]
+        result[name] = generate_statistics(data, "lower")
+    return result
+
+
+def build_assets():
     if not os.path.exists(WORK_DIR/"assets"):
         os.mkdir(WORK_DIR/"assets")
         bootstrap_root = PROJECT_ROOT/"examples"/"bootstrap"
@@ -53,35 +132,128 @@ def run_startup_test():
             f"cd {bootstrap_root} && make -f Makefile.native clean && make -f Makefile.native -j")
         shutil.copy(bootstrap_root/"bootstrap", WORK_DIR/"assets")
         print("bootstrap native compiled")
-    docker_result = []
-    for _ in range(100):
-        curr = run_simple_process([
-            "docker", "run", "--rm", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE
-        ])
-        docker_result.append(curr)
-    native_data = []
-    for _ in range(100):
-        curr = run_simple_process([str(WORK_DIR/"assets"/"bootstrap")])
-        native_data.append(curr)
-    wasm_bpf_data = []
-    for _ in range(100):
-        curr = run_simple_process(
-            [str(PROJECT_ROOT/"assets"/"wasm-bpf"), str(WORK_DIR/"assets"/"bootstrap.wasm")])
-        wasm_bpf_data.append(curr)
+    if not os.path.exists(WORK_DIR/"assets"/MARKER_NAME):
+        shutil.copy("/bin/true", WORK_DIR/"assets"/MARKER_NAME)
+
+
+def run_startup_test():
+    build_assets()
+    docker_result = repeat(lambda _: run_simple_process([
+        "docker", "run", "--rm", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE
+    ]), 100)
+    native_data = repeat(lambda _: run_simple_process(
+        [str(WORK_DIR/"assets"/"bootstrap")]), 100)
+    wasm_bpf_data = repeat(lambda _: run_simple_process(
+        [str(PROJECT_ROOT/"assets"/"wasm-bpf"), str(WORK_DIR/"assets"/"bootstrap.wasm")]), 100)
 
     result = {
-        "native": generate_statistics(native_data),
-        "wasm": generate_statistics(wasm_bpf_data),
-        "docker": generate_statistics(docker_result)
+        "environment": environment(),
+        "native": phase_statistics(native_data),
+        "wasm": phase_statistics(wasm_bpf_data),
+        "docker": phase_statistics(docker_result)
     }
+    # second series: time until the first event comes out of the tool
+    first_event_targets = {
+        "native": [str(WORK_DIR/"assets"/"bootstrap")],
+        "wasm": [str(PROJECT_ROOT/"assets"/"wasm-bpf"), str(WORK_DIR/"assets"/"bootstrap.wasm")],
+        "docker": ["docker", "run", "--rm", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE],
+    }
+    for name, cmd in first_event_targets.items():
+        samples = repeat(lambda _: run_first_event(cmd), 100)
+        result[name]["first_event"] = generate_statistics(
+            [first_event for _, first_event in samples], "lower")
+        result[name]["attach_to_first_event"] = generate_statistics(
+            [first_event - attach for attach, first_event in samples], "lower")
     print(result)
     import json
     with open(WORK_DIR/"startup.json", "w") as f:
         json.dump(result, f)
+    record_history("startup_benchmark", "startup.json", result)
+
+
+def run_storm(cmd: List[str], n: int) -> Tuple[float, List[float], int]:
+    """Start n instances at once and return the time until all of them are
+    attached, the time to attach of each one that did and how many failed.
+    The instances keep running until the last one is attached, so they
+    contend for the whole storm."""
+    times: List[Union[float, None]] = [None] * n
+    procs: List[subprocess.Popen] = [None] * n
+    start = threading.Barrier(n + 1)
+
+    def launch(i: int):
+        start.wait()
+        now = time.time()
+        # an exception would only end this thread, a failed instance keeps
+        # its time None and is counted instead
+        try:
+            procs[i] = subprocess.Popen(
+                pin_runtime(cmd), bufsize=0, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, shell=False,)
+        except OSError as e:
+            print(f"instance {i} failed to start: {e}")
+            return
+        line = b""
+        while procs[i].stdout:
+            line = procs[i].stdout.readline()
+            if not line or line.startswith(b"Attach ok!"):
+                break
+        if not line.startswith(b"Attach ok!"):
+            print(f"instance {i} exited before attaching")
+            return
+        times[i] = time.time() - now
+
+    threads = [threading.Thread(target=launch, args=(i,)) for i in range(n)]
+    for thread in threads:
+        thread.start()
+    start.wait()
+    now = time.time()
+    for thread in threads:
+        thread.join()
+    total = time.time() - now
+    for proc in procs:
+        if proc:
+            proc.send_signal(signal.SIGTERM)
+    for proc in procs:
+        if proc:
+            proc.wait()
+    attached = [t for t in times if t is not None]
+    print(cmd, n, total, n - len(attached), "failed")
+    return total, attached, n - len(attached)
+
+
+def run_storm_test():
+    """Cold start storm: launch 1 to 64 instances simultaneously, as on node
+    boot, and record the time to attach of every instance and of the whole
+    storm."""
+    build_assets()
+    targets = {
+        "native": [str(WORK_DIR/"assets"/"bootstrap")],
+        "wasm": [str(PROJECT_ROOT/"assets"/"wasm-bpf"), str(WORK_DIR/"assets"/"bootstrap.wasm")],
+        "docker": ["docker", "run", "--rm", "--privileged", "-v", "/sys:/sys", DOCKER_IMAGE],
+    }
+    result = {"environment": environment()}
+    for name, cmd in targets.items():
+        result[name] = {}
+        for n in STORM_SIZES:
+            runs = repeat(lambda _: run_storm(cmd, n), STORM_RUN_COUNT)
+            attached = [t for _, times, _ in runs for t in times]
+            result[name][n] = {
+                "all_attached": generate_statistics([total for total, _, _ in runs], "lower"),
+                "failed": generate_statistics([failed for _, _, failed in runs], "lower"),
+            }
+            if attached:
+                result[name][n]["time_to_attach"] = generate_statistics(attached, "lower")
+    print(result)
+    import json
+    with open(WORK_DIR/"storm.json", "w") as f:
+        json.dump(result, f)
+    record_history("startup_benchmark", "storm.json", result)
 
 
 def main():
-    run_startup_test()
+    if len(sys.argv) > 1 and sys.argv[1] == "storm":
+        run_storm_test()
+    else:
+        run_startup_test()
 
 
 if __name__ == "__main__":
@@ -9,6 +9,14 @@
 #include <string.h>
 
 #define POLL_TIMEOUT_MS 100
+/// called when the skeleton helpers finish a startup phase, with the phase
+/// name and the program it belongs to (or NULL). Define it before including
+/// this header to time the startup, see examples/bootstrap/startup_phases.h.
+#ifndef LIBBPF_WASM_PHASE
+#define LIBBPF_WASM_PHASE(phase, prog) \
+    do {                               \
+    } while (0)
+#endif
 #define IMPORT_MODULE "wasm_bpf"
 #define ATTR(name) \
     __attribute__((import_module(IMPORT_MODULE), import_name(name)))
@@ -168,6 +176,7 @@ static int bpf_object__load_skeleton(struct bpf_object_skeleton* s) {
     s->obj = wasm_load_bpf_object(s->data, s->data_sz);
     if (!s->obj)
         return -1;
+    LIBBPF_WASM_PHASE("load", NULL);
 
     for (int i = 0; i < s->map_cnt; i++) {
         struct bpf_map_skeleton* map_skel = (void*)s->maps + i * s->map_skel_sz;
@@ -201,6 +210,7 @@ static int bpf_object__attach_skeleton(struct bpf_object_skeleton* s) {
                     : attach_target);
             if (err < 0)
                 return err;
+            LIBBPF_WASM_PHASE("attach", (*prog_skel->prog)->name);
         }
     }
     return 0;
@@ -217,6 +227,8 @@ static void bpf_object__destroy_skeleton(struct bpf_object_skeleton* s) {
     free(s);
 }
 
+/* size is what the bpf side submitted, which may be less than the struct for
+ * variable-length records: only read data up to size */
 typedef int (*bpf_buffer_sample_fn)(void* ctx, void* data, size_t size);
 
 struct bpf_buffer {
@@ -247,10 +259,9 @@ static struct bpf_buffer* bpf_buffer__open(struct bpf_map* events,
     return buffer;
 }
 
-static int bpf_buffer__poll(struct bpf_buffer* buffer, int timeout_ms) {
+static int bpf_buffer__poll_timeout(struct bpf_buffer* buffer,
+                                    int timeout_ms) {
     assert(buffer && buffer->events && buffer->sample_fn);
-    if (timeout_ms <= 0)
-        timeout_ms = POLL_TIMEOUT_MS;
     char event_buffer[4096];
     int res = wasm_bpf_buffer_poll(
         buffer->events->obj_ptr, buffer->fd, (int32_t)buffer->sample_fn,
@@ -258,6 +269,18 @@ static int bpf_buffer__poll(struct bpf_buffer* buffer, int timeout_ms) {
     return res;
 }
 
+static int bpf_buffer__poll(struct bpf_buffer* buffer, int timeout_ms) {
+    if (timeout_ms <= 0)
+        timeout_ms = POLL_TIMEOUT_MS;
+    return bpf_buffer__poll_timeout(buffer, timeout_ms);
+}
+
+/* like ring_buffer__consume(): handle the events that are already there and
+ * return without waiting for new ones */
+static int bpf_buffer__consume(struct bpf_buffer* buffer) {
+    return bpf_buffer__poll_timeout(buffer, 0);
+}
+
 static void bpf_buffer__free(struct bpf_buffer* buffer) {
     assert(buffer);
     free(buffer);
@@ -488,4 +511,47 @@ static int bpf_map_get_next_key(int fd, const void* key, void* next_key) {
                                 next_key, 0);
 }
 
+/// number of possible CPUs, a lookup in a per-CPU map fills in one value
+/// per possible CPU, each rounded up to 8 bytes. Parses the cpu list in
+/// /sys/devices/system/cpu/possible like libbpf, so the runtime has to give
+/// the guest access to /sys.
+static int libbpf_num_possible_cpus(void) {
+    static int cpus;
+    char buf[128];
+    int start, end, n;
+    const char* p;
+    FILE* f;
+
+    if (cpus > 0)
+        return cpus;
+    f = fopen("/sys/devices/system/cpu/possible", "r");
+    if (!f)
+        return -errno;
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (!p)
+        return -EINVAL;
+    n = 0;
+    while (*p && *p != '\n') {
+        char* next;
+
+        start = end = strtol(p, &next, 10);
+        if (next == p)
+            return -EINVAL;
+        p = next;
+        if (*p == '-') {
+            end = strtol(p + 1, &next, 10);
+            p = next;
+        }
+        if (end < start)
+            return -EINVAL;
+        n += end - start + 1;
+        if (*p == ',')
+            p++;
+    }
+    if (!n)
+        return -EINVAL;
+    return cpus = n;
+}
+
 #endif  // _LIBBPF_WASM_H